@@ -6,9 +6,19 @@ set -e
 #   ./build.sh uf2                              # Build and flash via UF2 with USB (nrf52840)
 #   ./build.sh openocd nrf52dk/nrf52832         # Build and flash via OpenOCD (nrf52832)
 #   ./build.sh rtt nrf52dk/nrf52832             # Build, flash, and monitor RTT logs (nrf52832)
+#   LOG_PROFILE=production ./build.sh openocd   # Logging compiled out (prj.production.conf)
+#   LOG_PROFILE=dict ./build.sh uf2             # Dictionary logging (prj.dict.conf)
+#   BENCH=1 ./build.sh openocd nrf52dk/nrf52832 # GPIO phase markers (prj.bench.conf)
+#   SLOTS=1 ./build.sh uf2                      # One time-sliced legacy advertiser (prj.slots.conf)
+#   BEACON=1 APPLE_KEY=<hex> GOOGLE_KEY=<hex> ./build.sh openocd nrf52dk/nrf52810
+#                                               # Keys built in, no provisioning (prj.beacon.conf)
 
 METHOD=${1:-"uf2"}
 BOARD=${2:-"promicro_nrf52840/nrf52840"} # promicro_nrf52840/nrf52840"
+LOG_PROFILE=${LOG_PROFILE:-""}
+BENCH=${BENCH:-""}
+BEACON=${BEACON:-""}
+SLOTS=${SLOTS:-""}
 
 source ../ncs/export_env.sh
 
@@ -20,18 +30,51 @@ echo "========================================"
 cd ../ncs
 
 # Add config overlays based on method
+EXTRA_CONF=""
 if [ "${METHOD}" == "rtt" ]; then
   if [ "${2}" == "" ]; then
     echo "No board specified for RTT mode, defaulting to nrf52dk/nrf52832"
     BOARD="nrf52dk/nrf52832"
   fi
-  west build -p always -b "${BOARD}" -s .. -- -DEXTRA_CONF_FILE=prj.rtt.conf
+  EXTRA_CONF="prj.rtt.conf"
 elif [ "${METHOD}" == "uf2" ]; then
-  west build -p always -b "${BOARD}" -s .. -- -DEXTRA_CONF_FILE=prj.usb.conf
-else
-  west build -p always -b "${BOARD}" -s ..
+  EXTRA_CONF="prj.usb.conf"
+fi
+
+# The log profile goes last so it overrides the console overlays
+if [ -n "${LOG_PROFILE}" ]; then
+  EXTRA_CONF="${EXTRA_CONF:+${EXTRA_CONF};}prj.${LOG_PROFILE}.conf"
+fi
+
+# Phase markers for scripts/energy_bench.py, pins come from the board overlay
+CMAKE_ARGS=()
+if [ -n "${BENCH}" ]; then
+  EXTRA_CONF="${EXTRA_CONF:+${EXTRA_CONF};}prj.bench.conf"
+  CMAKE_ARGS+=("-DEXTRA_DTC_OVERLAY_FILE=boards/${BOARD//\//_}_bench.overlay")
+fi
+
+# Weighted time slicing instead of one advertising set per protocol
+if [ -n "${SLOTS}" ]; then
+  EXTRA_CONF="${EXTRA_CONF:+${EXTRA_CONF};}prj.slots.conf"
 fi
 
+# Beacon-only image, the keys end up in the firmware
+if [ -n "${BEACON}" ]; then
+  if [ -z "${APPLE_KEY}" ] || [ -z "${GOOGLE_KEY}" ]; then
+    echo "Error: BEACON=1 needs APPLE_KEY and GOOGLE_KEY (hex)"
+    exit 1
+  fi
+  EXTRA_CONF="${EXTRA_CONF:+${EXTRA_CONF};}prj.beacon.conf"
+  CMAKE_ARGS+=("-DCONFIG_TAG_BUILTIN_APPLE_KEY=\"${APPLE_KEY}\"")
+  CMAKE_ARGS+=("-DCONFIG_TAG_BUILTIN_GOOGLE_KEY=\"${GOOGLE_KEY}\"")
+fi
+
+if [ -n "${EXTRA_CONF}" ]; then
+  CMAKE_ARGS+=("-DEXTRA_CONF_FILE=${EXTRA_CONF}")
+fi
+
+west build -p always -b "${BOARD}" -s .. -- "${CMAKE_ARGS[@]}"
+
   HEX_FILE="build/merged.hex"
 
 if [ "${METHOD}" == "uf2" ]; then
@@ -0,0 +1,285 @@
+#!/usr/bin/env python3
+"""Measure tag current per lifecycle phase, interval profile and protocol.
+
+For every profile the tag is flashed with a BENCH=1 build (build.sh erases
+it), recorded from boot, provisioned with provision_keys.py and left
+beaconing. The GPIO phase markers (src/bench.h) recorded next to the
+current split the trace into lifecycle states and, with a single
+advertiser, into the protocol on air. Results go to a JSON report, and
+--compare checks them against an earlier report, e.g. from the previous
+commit.
+
+Meters:
+  ppk2  Nordic PPK2 in source meter mode, markers on logic port D0-D2
+        (pip install ppk2-api)
+  otii  Qoitech Otii Arc through the Otii TCP server, state markers on
+        GPI1/GPI2, no protocol marker (pip install otii_tcp_client)
+"""
+
+import argparse
+import datetime
+import json
+import os
+import shlex
+import subprocess
+import sys
+import threading
+import time
+
+SCRIPTS_DIR = os.path.dirname(os.path.abspath(__file__))
+
+# Same order as tag_state_t and ADV_PROFILES in provision_keys.py
+STATES = ["unprovisioned", "provisioning", "beaconing", "rotating"]
+PROTOCOLS = ["apple", "google"]
+PROFILES = ["fast", "balanced", "longevity"]
+
+
+class PhaseAccumulator:
+    """Running current sums per (state, protocol), no trace is kept."""
+
+    def __init__(self, sample_period: float):
+        self.sample_period = sample_period
+        self.sums = {}
+        self.counts = {}
+
+    def add(self, state: int, protocol: int, current_ua: float) -> None:
+        key = (state, protocol)
+        self.sums[key] = self.sums.get(key, 0.0) + current_ua
+        self.counts[key] = self.counts.get(key, 0) + 1
+
+    def _summary(self, keys: list) -> dict | None:
+        count = sum(self.counts[k] for k in keys)
+        if count == 0:
+            return None
+        total = sum(self.sums[k] for k in keys)
+        return {"avg_ua": round(total / count, 2), "seconds": round(count * self.sample_period, 3)}
+
+    def report(self) -> dict:
+        keys = list(self.counts)
+        phases = {}
+        for state, name in enumerate(STATES):
+            summary = self._summary([k for k in keys if k[0] == state])
+            if summary:
+                phases[name] = summary
+
+        # The protocol marker only means something once beacons are on air
+        beacon_states = (STATES.index("beaconing"), STATES.index("rotating"))
+        protocols = {}
+        for protocol, name in enumerate(PROTOCOLS):
+            summary = self._summary([k for k in keys if k[0] in beacon_states and k[1] == protocol])
+            if summary:
+                protocols[name] = summary
+
+        return {
+            "phases": phases,
+            "protocols": protocols,
+            "beacon": self._summary([k for k in keys if k[0] in beacon_states]),
+        }
+
+
+class Ppk2Meter:
+    """PPK2 powering the tag, digital channels sampled with every current sample."""
+
+    SAMPLE_PERIOD = 10e-6
+
+    def __init__(self, port: str | None, voltage_mv: int):
+        from ppk2_api.ppk2_api import PPK2_API
+
+        if port is None:
+            devices = PPK2_API.list_devices()
+            if not devices:
+                raise SystemExit("No PPK2 found")
+            port = devices[0][0] if isinstance(devices[0], tuple) else devices[0]
+        self.ppk = PPK2_API(port)
+        self.ppk.get_modifiers()
+        self.ppk.use_source_meter()
+        self.ppk.set_source_voltage(voltage_mv)
+        self.acc = None
+        self.running = False
+        self.thread = None
+
+    def power(self, on: bool) -> None:
+        self.ppk.toggle_DUT_power("ON" if on else "OFF")
+
+    def _read(self) -> None:
+        while self.running:
+            data = self.ppk.get_data()
+            if not data:
+                time.sleep(0.001)
+                continue
+            samples, raw_digital = self.ppk.get_samples(data)
+            for current_ua, logic in zip(samples, raw_digital):
+                self.acc.add(logic & 0x3, (logic >> 2) & 0x1, current_ua)
+
+    def start(self) -> None:
+        self.acc = PhaseAccumulator(self.SAMPLE_PERIOD)
+        self.running = True
+        self.ppk.start_measuring()
+        self.thread = threading.Thread(target=self._read, daemon=True)
+        self.thread.start()
+
+    def stop(self) -> PhaseAccumulator:
+        self.running = False
+        self.thread.join()
+        self.ppk.stop_measuring()
+        return self.acc
+
+
+class OtiiMeter:
+    """Otii Arc main output, GPI1/GPI2 recorded as the two state bits."""
+
+    def __init__(self, voltage_mv: int):
+        from otii_tcp_client import otii_client
+
+        self.otii = otii_client.OtiiClient().connect()
+        devices = self.otii.get_devices()
+        if not devices:
+            raise SystemExit("No Otii device found")
+        self.arc = devices[0]
+        self.arc.set_main_voltage(voltage_mv / 1000)
+        for channel in ("mc", "i1", "i2"):
+            self.arc.enable_channel(channel, True)
+        self.project = self.otii.get_active_project() or self.otii.create_project()
+
+    def power(self, on: bool) -> None:
+        self.arc.set_main(on)
+
+    def start(self) -> None:
+        self.project.start_recording()
+
+    def _channel(self, recording, channel: str) -> dict:
+        count = recording.get_channel_data_count(self.arc.id, channel)
+        return recording.get_channel_data(self.arc.id, channel, 0, count)
+
+    def stop(self) -> PhaseAccumulator:
+        self.project.stop_recording()
+        recording = self.project.get_last_recording()
+        current = self._channel(recording, "mc")
+        bits = [self._channel(recording, "i1"), self._channel(recording, "i2")]
+
+        # Channels can run at different rates, look the markers up by time
+        acc = PhaseAccumulator(current["interval"])
+        for i, amps in enumerate(current["values"]):
+            t = i * current["interval"]
+            state = 0
+            for bit, gpi in enumerate(bits):
+                j = min(int(t / gpi["interval"]), len(gpi["values"]) - 1)
+                state |= (1 if gpi["values"][j] else 0) << bit
+            acc.add(state, 0, amps * 1e6)
+        return acc
+
+
+def git_revision() -> str:
+    try:
+        return subprocess.run(["git", "describe", "--always", "--dirty"], cwd=SCRIPTS_DIR,
+                              capture_output=True, text=True, check=True).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return "unknown"
+
+
+def flash(args) -> None:
+    env = dict(os.environ, BENCH="1")
+    subprocess.run(["./build.sh", args.method, args.board], cwd=SCRIPTS_DIR, env=env, check=True)
+
+
+def run_profile(meter, args, profile: str) -> dict:
+    print(f"=== {profile} ===")
+    meter.power(True)
+    if not args.no_flash:
+        flash(args)
+
+    meter.start()
+    try:
+        time.sleep(args.settle)
+        subprocess.run([sys.executable, "provision_keys.py", "--profile", profile,
+                        *shlex.split(args.provision_args)], cwd=SCRIPTS_DIR, check=True)
+        print(f"Recording beacons for {args.beacon_time} s...")
+        time.sleep(args.beacon_time)
+    finally:
+        acc = meter.stop()
+
+    result = acc.report()
+    for name, summary in result["phases"].items():
+        print(f"  {name:14} {summary['avg_ua']:10.2f} uA  ({summary['seconds']:.1f} s)")
+    for name, summary in result["protocols"].items():
+        print(f"  {name:14} {summary['avg_ua']:10.2f} uA  ({summary['seconds']:.1f} s)")
+    return result
+
+
+def compare(report: dict, baseline: dict, threshold: float) -> bool:
+    """Print the change per profile and phase, False if any got worse than threshold %."""
+    ok = True
+    print(f"\nAgainst {baseline.get('revision', '?')}:")
+    for profile, result in report["profiles"].items():
+        old = baseline.get("profiles", {}).get(profile)
+        if not old:
+            continue
+        rows = [(name, summary, old["phases"].get(name)) for name, summary in result["phases"].items()]
+        rows += [(name, summary, old["protocols"].get(name)) for name, summary in result["protocols"].items()]
+        for name, summary, old_summary in rows:
+            if not old_summary or old_summary["avg_ua"] == 0:
+                continue
+            change = (summary["avg_ua"] - old_summary["avg_ua"]) / old_summary["avg_ua"] * 100
+            flag = ""
+            if change > threshold:
+                flag = "  REGRESSION"
+                ok = False
+            print(f"  {profile:10} {name:14} {old_summary['avg_ua']:10.2f} -> {summary['avg_ua']:10.2f} uA "
+                  f"({change:+.1f} %){flag}")
+    return ok
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser(description="Measure tag current per phase, profile and protocol.")
+    parser.add_argument("--meter", choices=["ppk2", "otii"], default="ppk2", help="Current meter (default: ppk2)")
+    parser.add_argument("--port", help="PPK2 serial port (default: first PPK2 found)")
+    parser.add_argument("--voltage", type=int, default=3000, help="Supply voltage in mV (default: 3000)")
+    parser.add_argument("--board", default="nrf52dk/nrf52832", help="Board passed to build.sh (default: nrf52dk/nrf52832)")
+    parser.add_argument("--method", default="openocd", help="build.sh flashing method (default: openocd)")
+    parser.add_argument("--no-flash", action="store_true", help="Use the firmware already on the (erased) tag")
+    parser.add_argument("--profiles", nargs="+", choices=PROFILES, default=PROFILES, help="Profiles to measure (default: all)")
+    parser.add_argument("--settle", type=float, default=5.0, help="Seconds recorded before provisioning (default: 5)")
+    parser.add_argument("--beacon-time", type=float, default=60.0, help="Seconds recorded while beaconing (default: 60)")
+    parser.add_argument("--provision-args", default="", help="Extra provision_keys.py arguments, e.g. \"--eik ...\"")
+    parser.add_argument("--output", default="bench_report.json", help="JSON report (default: bench_report.json)")
+    parser.add_argument("--compare", help="Earlier report to compare against")
+    parser.add_argument("--threshold", type=float, default=5.0, help="Regression threshold in %% (default: 5)")
+    args = parser.parse_args()
+
+    # A provisioned tag ignores new keys until it is erased by the next flash
+    if args.no_flash and len(args.profiles) > 1:
+        raise SystemExit("--no-flash can only measure one profile")
+
+    if args.meter == "ppk2":
+        meter = Ppk2Meter(args.port, args.voltage)
+    else:
+        meter = OtiiMeter(args.voltage)
+
+    report = {
+        "revision": git_revision(),
+        "date": datetime.datetime.now(datetime.timezone.utc).isoformat(timespec="seconds"),
+        "board": args.board,
+        "meter": args.meter,
+        "voltage_mv": args.voltage,
+        "beacon_time_s": args.beacon_time,
+        "profiles": {},
+    }
+    try:
+        for profile in args.profiles:
+            report["profiles"][profile] = run_profile(meter, args, profile)
+    finally:
+        meter.power(False)
+
+    with open(args.output, "w") as f:
+        json.dump(report, f, indent=2)
+    print(f"\nReport written to {args.output}")
+
+    if args.compare:
+        with open(args.compare) as f:
+            baseline = json.load(f)
+        if not compare(report, baseline, args.threshold):
+            sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
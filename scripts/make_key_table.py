@@ -0,0 +1,47 @@
+#!/usr/bin/env python3
+"""Build a key table image for CONFIG_TAG_KEY_TABLE from a list of Apple keys."""
+
+import argparse
+import base64
+import struct
+
+KEY_TABLE_MAGIC = 0x544B5448  # "HTKT"
+KEY_TABLE_VERSION = 1
+KEY_SIZE = 28
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser(description="Build a key table image from base64 Apple keys (one per line).")
+    parser.add_argument("keys", help="Text file with one 28-byte Apple public key (base64) per line")
+    parser.add_argument("--out", default="key_table.bin", help="Output image (default: key_table.bin)")
+    parser.add_argument("--size", type=lambda x: int(x, 0), default=0x32000, help="Partition size in bytes (default: 0x32000)")
+    args = parser.parse_args()
+
+    keys = []
+    with open(args.keys) as f:
+        for lineno, line in enumerate(f, 1):
+            line = line.strip()
+            if not line or line.startswith("#"):
+                continue
+            key = base64.b64decode(line)
+            if len(key) != KEY_SIZE:
+                raise SystemExit(f"{args.keys}:{lineno}: key must be {KEY_SIZE} bytes, got {len(key)}")
+            keys.append(key)
+
+    if not keys:
+        raise SystemExit("No keys found")
+
+    header = struct.pack("<IHHII", KEY_TABLE_MAGIC, KEY_TABLE_VERSION, KEY_SIZE, len(keys), 0xFFFFFFFF)
+    image = header + b"".join(keys)
+    if len(image) > args.size:
+        max_keys = (args.size - len(header)) // KEY_SIZE
+        raise SystemExit(f"{len(keys)} keys do not fit in {args.size:#x} bytes (max {max_keys})")
+
+    with open(args.out, "wb") as f:
+        f.write(image)
+
+    print(f"Wrote {len(keys)} keys ({len(image)} bytes) to {args.out}")
+
+
+if __name__ == "__main__":
+    main()
@@ -1,6 +1,17 @@
 import argparse
 import asyncio
 import base64
+import csv
+import ctypes
+import fcntl
+import json
+import os
+import random
+import socket
+import struct
+import time
+import zlib
+from dataclasses import dataclass, replace
 
 from bleak import BleakClient, BleakScanner
 
@@ -8,22 +19,320 @@ from bleak import BleakClient, BleakScanner
 SERVICE_UUID = "12345678-1234-5678-1234-56789abcdef0"
 APPLE_KEY_UUID = "12345678-1234-5678-1234-56789abcdef1"
 GOOGLE_KEY_UUID = "12345678-1234-5678-1234-56789abcdef2"
+GOOGLE_EIK_UUID = "12345678-1234-5678-1234-56789abcdef3"
+ADV_PROFILE_UUID = "12345678-1234-5678-1234-56789abcdef4"
+PROV_BLOB_UUID = "12345678-1234-5678-1234-56789abcdef5"
+PROV_DIGEST_UUID = "12345678-1234-5678-1234-56789abcdef6"
+QUIET_HOURS_UUID = "12345678-1234-5678-1234-56789abcdef8"
 
+# The config scan response (or, in scan-only builds, the ID advertisement)
+# carries the hardware device ID, see config_sd and id_ad
+DEVICE_ID_COMPANY = 0xFFE0
+
+ADV_PROFILES = {"fast": 0, "balanced": 1, "longevity": 2}
+
+# Legacy Apple key characteristic: first chunk size, the rest follows in a second write
+APPLE_KEY_CHUNK = 20
+
+PROV_BLOB_VERSION = 1
+PROV_BLOB_FLAG_EIK = 0x01
+PROV_BLOB_PROFILE_KEEP = 0xFF
+
+PROV_DIGEST_FLAG_COMPLETE = 0x01
+PROV_DIGEST_FLAG_EIK = 0x02
+
+
+def build_prov_blob(apple_key: bytes, google_key: bytes, eik: bytes | None, profile: int) -> bytes:
+    """Version, flags, profile, Apple key, Google key or EIK, CRC32 (LE)."""
+    flags = PROV_BLOB_FLAG_EIK if eik is not None else 0
+    body = bytes([PROV_BLOB_VERSION, flags, profile]) + apple_key + (eik if eik is not None else google_key)
+    return body + struct.pack("<I", zlib.crc32(body))
+
+
+def parse_quiet_hours(text: str) -> tuple[int, int]:
+    """Local "HH:MM-HH:MM" to minutes after UTC midnight, at today's UTC offset."""
+    offset = time.localtime().tm_gmtoff // 60
+    window = []
+    for part in text.split("-"):
+        hours, minutes = (int(x) for x in part.split(":"))
+        if not (0 <= hours < 24 and 0 <= minutes < 60):
+            raise ValueError(f"Invalid time '{part}'")
+        window.append((hours * 60 + minutes - offset) % 1440)
+    if len(window) != 2:
+        raise ValueError("Quiet hours must look like 22:00-06:00")
+    return window[0], window[1]
+
+
+def build_quiet_hours(window: tuple[int, int]) -> bytes:
+    """Current UTC time, window start and end (see QUIET_HOURS_SIZE in main.h)."""
+    return struct.pack("<IHH", int(time.time()), *window)
+
+
+# Key table upload over L2CAP CoC (CONFIG_TAG_KEY_UPLOAD), see src/key_upload.h
+KEY_UPLOAD_PSM = 0x80
+KEY_UPLOAD_CHUNK_SIZE = 4096
+KEY_UPLOAD_OP_START = 0x01
+KEY_UPLOAD_OP_DATA = 0x02
+KEY_UPLOAD_OP_COMMIT = 0x03
+KEY_UPLOAD_OP_RSP = 0x80
+
+BDADDR_LE_PUBLIC = 0x01
+BDADDR_LE_RANDOM = 0x02
+
+# _IOR('H', 211, int), fills struct hci_dev_info (under 128 bytes)
+HCIGETDEVINFO = 0x800448D3
+HCI_DEV_INFO_SIZE = 128
+
+
+class SockaddrL2(ctypes.Structure):
+    """struct sockaddr_l2, Python's socket module cannot set the LE address type."""
+    _fields_ = [
+        ("l2_family", ctypes.c_ushort),
+        ("l2_psm", ctypes.c_ushort),
+        ("l2_bdaddr", ctypes.c_ubyte * 6),
+        ("l2_cid", ctypes.c_ushort),
+        ("l2_bdaddr_type", ctypes.c_ubyte),
+    ]
+
+
+def adapter_bdaddr(adapter: str) -> bytes:
+    """Address of a BlueZ adapter (hciN) in socket byte order, from HCIGETDEVINFO."""
+    info = bytearray(HCI_DEV_INFO_SIZE)
+    struct.pack_into("<H", info, 0, int(adapter.removeprefix("hci")))
+    with socket.socket(socket.AF_BLUETOOTH, socket.SOCK_RAW, socket.BTPROTO_HCI) as hci:
+        fcntl.ioctl(hci.fileno(), HCIGETDEVINFO, info)
+    # struct hci_dev_info: dev_id (2), name (8), bdaddr (6), ...
+    return bytes(info[10:16])
 
-async def main() -> None:
-    parser = argparse.ArgumentParser(description="Provision Apple and Google keys over BLE.")
-    parser.add_argument("--name", default="HYBRID-TAG", help="BLE name to match")
-    parser.add_argument("--key", default="WPS9RJBtGkPLvMvFBhvKkofMabkdsdiPzLBSzg==", help="28-byte Apple key (base64)")
-    parser.add_argument("--keyGoogle", default="34aaaffb11e8bf854630bd2ce56fa6b06603b20b", help="20-byte Google key (hex)")
-    args = parser.parse_args()
 
-    apple_key = base64.b64decode(args.key)
+def l2cap_connect(address: str, address_type: int, psm: int, adapter: str | None = None) -> socket.socket:
+    """Open an LE credit-based channel (BlueZ only), reusing the existing link.
+
+    With an adapter the socket is bound to it first, so the channel goes over
+    the link that adapter holds rather than through the default controller.
+    """
+    if not hasattr(socket, "BTPROTO_L2CAP"):
+        raise RuntimeError("Key table upload needs Linux Bluetooth sockets")
+
+    libc = ctypes.CDLL(None, use_errno=True)
+    sock = socket.socket(socket.AF_BLUETOOTH, socket.SOCK_SEQPACKET, socket.BTPROTO_L2CAP)
+    try:
+        if adapter:
+            local = SockaddrL2()
+            local.l2_family = socket.AF_BLUETOOTH
+            local.l2_bdaddr[:] = adapter_bdaddr(adapter)
+            local.l2_bdaddr_type = BDADDR_LE_PUBLIC
+            if libc.bind(sock.fileno(), ctypes.byref(local), ctypes.sizeof(local)) != 0:
+                err = ctypes.get_errno()
+                raise OSError(err, f"L2CAP bind to {adapter} failed: {os.strerror(err)}")
+
+        addr = SockaddrL2()
+        addr.l2_family = socket.AF_BLUETOOTH
+        addr.l2_psm = psm
+        addr.l2_bdaddr[:] = bytes.fromhex(address.replace(":", ""))[::-1]
+        addr.l2_bdaddr_type = address_type
+
+        if libc.connect(sock.fileno(), ctypes.byref(addr), ctypes.sizeof(addr)) != 0:
+            err = ctypes.get_errno()
+            raise OSError(err, f"L2CAP connect to PSM {psm:#x} failed: {os.strerror(err)}")
+    except BaseException:
+        sock.close()
+        raise
+    sock.settimeout(10.0)
+    return sock
+
+
+def upload_request(sock: socket.socket, request: bytes) -> int:
+    """Send one request SDU and wait for its response, returns the response value."""
+    sock.send(request)
+    rsp = sock.recv(16)
+    op, status, value = struct.unpack("<BBI", rsp[:6])
+    if op != request[0] | KEY_UPLOAD_OP_RSP:
+        raise RuntimeError(f"Unexpected key upload response {rsp.hex()}")
+    if status:
+        raise RuntimeError(f"Key upload request {request[0]:#04x} failed: {os.strerror(status)}")
+    return value
+
+
+def upload_key_table(address: str, address_type: int, image: bytes, psm: int, adapter: str | None = None) -> int:
+    """Stream a key table image into the tag's flash, returns the number of keys."""
+    sock = l2cap_connect(address, address_type, psm, adapter)
+    try:
+        start = time.monotonic()
+        upload_request(sock, struct.pack("<BII", KEY_UPLOAD_OP_START, len(image), zlib.crc32(image)))
+        for offset in range(0, len(image), KEY_UPLOAD_CHUNK_SIZE):
+            chunk = image[offset:offset + KEY_UPLOAD_CHUNK_SIZE]
+            upload_request(sock, struct.pack("<BII", KEY_UPLOAD_OP_DATA, offset, zlib.crc32(chunk)) + chunk)
+            print(f"  {offset + len(chunk)}/{len(image)} bytes", end="\r")
+        count = upload_request(sock, bytes([KEY_UPLOAD_OP_COMMIT]))
+        elapsed = time.monotonic() - start
+        print(f"\nUploaded {count} keys in {elapsed:.1f} s ({len(image) / elapsed / 1024:.1f} KiB/s)")
+        return count
+    finally:
+        sock.close()
+
+
+def bluez_address_type(device) -> int:
+    props = device.details.get("props", {}) if isinstance(device.details, dict) else {}
+    return BDADDR_LE_PUBLIC if props.get("AddressType") == "public" else BDADDR_LE_RANDOM
+
+
+@dataclass
+class KeySet:
+    apple_key: bytes
+    google_key: bytes
+    eik: bytes | None = None
+    profile: str | None = None
+    table: str | None = None
+    device_id: str | None = None  # Only this tag may take the set, any tag if None
+
+
+def make_key_set(apple_b64: str, google_hex: str, eik_hex: str | None = None, profile: str | None = None,
+                 table: str | None = None, device_id: str | None = None) -> KeySet:
+    apple_key = base64.b64decode(apple_b64)
     if len(apple_key) != 28:
-        raise SystemExit("Apple key must be 28 bytes")
+        raise ValueError("Apple key must be 28 bytes")
 
-    google_key = bytes.fromhex(args.keyGoogle)
+    google_key = bytes.fromhex(google_hex) if google_hex else bytes(20)
     if len(google_key) != 20:
-        raise SystemExit("Google key must be 20 bytes")
+        raise ValueError("Google key must be 20 bytes")
+
+    eik = bytes.fromhex(eik_hex) if eik_hex else None
+    if eik is not None and len(eik) != 32:
+        raise ValueError("Google identity key must be 32 bytes")
+
+    if profile and profile not in ADV_PROFILES:
+        raise ValueError(f"Unknown profile '{profile}'")
+
+    return KeySet(apple_key, google_key, eik, profile or None, table or None,
+                  device_id.lower() if device_id else None)
+
+
+def load_manifest(path: str) -> list[KeySet]:
+    """CSV with a header row or a JSON list of objects, fields:
+    apple_key (base64), google_key (hex), eik (hex), profile, table, device_id (hex)."""
+    with open(path, newline="") as f:
+        rows = json.load(f) if path.endswith(".json") else list(csv.DictReader(f))
+
+    key_sets = []
+    for n, row in enumerate(rows, 1):
+        try:
+            key_sets.append(make_key_set(row["apple_key"], row.get("google_key", ""), row.get("eik"),
+                                         row.get("profile"), row.get("table"), row.get("device_id")))
+        except (KeyError, ValueError) as e:
+            raise SystemExit(f"{path}: entry {n}: {e}")
+    return key_sets
+
+
+def write_manifest(path: str, key_sets: list[KeySet]) -> None:
+    """The CSV load_manifest() reads, so the sets can be fed to another run."""
+    with open(path, "w", newline="") as f:
+        writer = csv.writer(f)
+        writer.writerow(["apple_key", "google_key", "eik", "profile", "table", "device_id"])
+        for k in key_sets:
+            writer.writerow([base64.b64encode(k.apple_key).decode(), k.google_key.hex(), k.eik.hex() if k.eik else "",
+                             k.profile or "", k.table or "", k.device_id or ""])
+
+
+def device_id_of(adv) -> str | None:
+    data = adv.manufacturer_data.get(DEVICE_ID_COMPANY)
+    return data[:4].hex() if data and len(data) >= 4 else None
+
+
+async def write_legacy(client: BleakClient, key_set: KeySet, log=print) -> None:
+    """One characteristic per key, for firmware without the blob characteristic."""
+    # Set the profile first, it is applied when the keys start beaconing
+    if key_set.profile:
+        log(f"Setting advertising profile: {key_set.profile}")
+        await client.write_gatt_char(ADV_PROFILE_UUID, bytes([ADV_PROFILES[key_set.profile]]), response=True)
+
+    # Always the 20 + 8 byte chunks, the only split every firmware takes whatever the MTU
+    chunks = [key_set.apple_key[:APPLE_KEY_CHUNK], key_set.apple_key[APPLE_KEY_CHUNK:]]
+    log(f"Writing Apple key ({len(key_set.apple_key)} bytes) in {len(chunks)} chunks...")
+
+    for i, chunk in enumerate(chunks):
+        log(f"  Writing chunk {i + 1}: {len(chunk)} bytes")
+        await client.write_gatt_char(APPLE_KEY_UUID, chunk, response=True)
+
+    if key_set.eik is not None:
+        # Longer than the default MTU, the stack turns this into a long write
+        log(f"Writing Google identity key ({len(key_set.eik)} bytes)...")
+        await client.write_gatt_char(GOOGLE_EIK_UUID, key_set.eik, response=True)
+    else:
+        # Write Google key (20 bytes fits in single write)
+        log(f"Writing Google key ({len(key_set.google_key)} bytes)...")
+        await client.write_gatt_char(GOOGLE_KEY_UUID, key_set.google_key, response=True)
+
+
+async def verify(client: BleakClient, key_set: KeySet, table_keys: int | None, log=print) -> None:
+    """Compare the tag's provisioning digest with what was written, raises on mismatch."""
+    digest = await client.read_gatt_char(PROV_DIGEST_UUID)
+    crc, profile, flags, table_count = struct.unpack("<IBBI", digest[:10])
+    expected_crc = zlib.crc32(key_set.apple_key + (key_set.eik if key_set.eik is not None else key_set.google_key))
+
+    problems = []
+    if crc != expected_crc:
+        problems.append(f"key CRC {crc:08x}, expected {expected_crc:08x}")
+    if not flags & PROV_DIGEST_FLAG_COMPLETE:
+        problems.append("keys incomplete")
+    if bool(flags & PROV_DIGEST_FLAG_EIK) != (key_set.eik is not None):
+        problems.append("identity key flag")
+    if key_set.profile and profile != ADV_PROFILES[key_set.profile]:
+        problems.append(f"profile {profile}, expected {ADV_PROFILES[key_set.profile]}")
+    if table_keys is not None and table_count != table_keys:
+        problems.append(f"key table {table_count} keys, expected {table_keys}")
+    if problems:
+        raise RuntimeError("Digest mismatch: " + ", ".join(problems))
+    log(f"Digest verified (CRC {crc:08x})")
+
+
+async def provision(client: BleakClient, device, key_set: KeySet, args, log=print,
+                    adapter: str | None = None) -> None:
+    """Write one key set to a connected tag in config mode, over adapter if given."""
+    if args.list_services:
+        for service in client.services:
+            log(f"Service: {service.uuid}")
+            for char in service.characteristics:
+                log(f"  Characteristic: {char.uuid} {char.properties}")
+
+    mtu = client.mtu_size
+    log(f"MTU: {mtu} bytes (max write: {mtu - 3} bytes)")
+
+    # The table goes first, the keys below end config mode
+    table_keys = None
+    if key_set.table:
+        with open(key_set.table, "rb") as f:
+            image = f.read()
+        log(f"Uploading key table ({len(image)} bytes) over L2CAP PSM {args.psm:#x}...")
+        table_keys = await asyncio.to_thread(upload_key_table, device.address, bluez_address_type(device),
+                                             image, args.psm, adapter)
+
+    # Before the keys, which end config mode
+    if args.quiet:
+        window = parse_quiet_hours(args.quiet)
+        log(f"Setting quiet hours: {args.quiet} ({window[0] // 60:02}:{window[0] % 60:02}-"
+            f"{window[1] // 60:02}:{window[1] % 60:02} UTC)")
+        await client.write_gatt_char(QUIET_HOURS_UUID, build_quiet_hours(window), response=True)
+
+    if args.legacy:
+        await write_legacy(client, key_set, log)
+    else:
+        profile = ADV_PROFILES[key_set.profile] if key_set.profile else PROV_BLOB_PROFILE_KEEP
+        blob = build_prov_blob(key_set.apple_key, key_set.google_key, key_set.eik, profile)
+        # Single write with a negotiated MTU, otherwise the stack turns it into a long write
+        log(f"Writing provisioning blob ({len(blob)} bytes)...")
+        await client.write_gatt_char(PROV_BLOB_UUID, blob, response=True)
+
+    # The tag holds off beaconing until we disconnect, so this is still config mode
+    if not args.no_verify:
+        await verify(client, key_set, table_keys, log)
+
+
+async def run_single(args) -> None:
+    try:
+        key_set = make_key_set(args.key, args.keyGoogle, args.eik, args.profile, args.table)
+    except ValueError as e:
+        raise SystemExit(str(e))
 
     print("Scanning...")
     device = await BleakScanner.find_device_by_name(args.name, timeout=60.0)
@@ -33,35 +342,181 @@ async def main() -> None:
     print(f"Found {device.name}, connecting...")
     async with BleakClient(device) as client:
         print("Connected")
+        await provision(client, device, key_set, args)
+        print("\nDone! Both keys configured.")
 
-        # List services and characteristics
-        for service in client.services:
-            print(f"Service: {service.uuid}")
-            for char in service.characteristics:
-                print(f"  Characteristic: {char.uuid}")
-                print(f"  Properties: {char.properties}")
 
-        # Get MTU
-        mtu = client.mtu_size
-        print(f"\nMTU: {mtu} bytes (max write: {mtu - 3} bytes)")
+@dataclass
+class Job:
+    device_id: str
+    device: object
+    key_set: KeySet
+    index: int
+    attempts: int = 0
+    adapter: str = ""
+    error: str = ""
 
-        # Split Apple key into chunks that fit within MTU
-        chunk_size = mtu - 3  # 20 bytes for MTU 23
-        print(f"\nWriting Apple key ({len(apple_key)} bytes) in {(len(apple_key) + chunk_size - 1) // chunk_size} chunks...")
 
-        for i in range(0, len(apple_key), chunk_size):
-            chunk = apple_key[i:i + chunk_size]
-            print(f"  Writing chunk {i // chunk_size + 1}: {len(chunk)} bytes (offset {i})")
-            await client.write_gatt_char(APPLE_KEY_UUID, chunk, response=True)
+class Fleet:
+    """A scanner per adapter feeds tags to per-adapter workers, failed tags retry with backoff."""
 
-        print("Apple key written!")
+    def __init__(self, args, key_sets: list[KeySet]):
+        self.args = args
+        self.key_sets = key_sets
+        self.free = [i for i, k in enumerate(key_sets) if k.device_id is None]
+        self.by_id = {k.device_id: i for i, k in enumerate(key_sets) if k.device_id is not None}
+        self.jobs: dict[str, Job] = {}   # device ID -> job, keeps its key set across retries
+        self.busy: set[str] = set()
+        self.retry_at: dict[str, float] = {}
+        self.done: list[Job] = []
+        self.failed: list[Job] = []
+        self.queue: asyncio.Queue[Job] = asyncio.Queue()
+        self.finished = asyncio.Event()
 
-        # Write Google key (20 bytes fits in single write)
-        print(f"\nWriting Google key ({len(google_key)} bytes)...")
-        await client.write_gatt_char(GOOGLE_KEY_UUID, google_key, response=True)
-        print("Google key written!")
+    def remaining(self) -> int:
+        return len(self.key_sets) - len(self.done) - len(self.failed)
 
-        print("\nDone! Both keys configured.")
+    def on_advertisement(self, device, adv) -> None:
+        device_id = device_id_of(adv)
+        if device_id is None or adv.local_name != self.args.name or device_id in self.busy:
+            return
+        if time.monotonic() < self.retry_at.get(device_id, 0):
+            return
+
+        job = self.jobs.get(device_id)
+        if job is None:
+            if device_id in self.by_id:
+                index = self.by_id.pop(device_id)
+            elif self.free:
+                index = self.free.pop(0)
+            else:
+                return
+            job = self.jobs[device_id] = Job(device_id, device, self.key_sets[index], index)
+        elif job in self.done or job in self.failed:
+            return
+
+        job.device = device
+        self.busy.add(device_id)
+        self.queue.put_nowait(job)
+
+    async def worker(self, adapter: str) -> None:
+        while True:
+            job = await self.queue.get()
+            job.attempts += 1
+            job.adapter = adapter
+            log = lambda msg, j=job: print(f"[{j.device_id} {adapter}] {msg}")
+            try:
+                async with BleakClient(job.device.address, adapter=adapter, timeout=self.args.connect_timeout) as client:
+                    await provision(client, job.device, job.key_set, self.args, log, adapter)
+                job.error = ""
+                self.done.append(job)
+                log(f"OK (key set {job.index}, attempt {job.attempts})")
+            except Exception as e:  # noqa: BLE001 - any failure goes to the retry queue
+                job.error = f"{type(e).__name__}: {e}"
+                if job.attempts >= self.args.retries:
+                    self.failed.append(job)
+                    log(f"FAILED after {job.attempts} attempts: {job.error}")
+                else:
+                    backoff = self.args.backoff * 2 ** (job.attempts - 1) * random.uniform(0.8, 1.2)
+                    self.retry_at[job.device_id] = time.monotonic() + backoff
+                    log(f"attempt {job.attempts} failed ({job.error}), retrying in {backoff:.1f} s")
+            finally:
+                self.busy.discard(job.device_id)
+                self.queue.task_done()
+                if self.remaining() == 0:
+                    self.finished.set()
+
+    def write_report(self, path: str) -> None:
+        with open(path, "w", newline="") as f:
+            writer = csv.writer(f)
+            writer.writerow(["device_id", "address", "adapter", "key_set", "status", "attempts", "error"])
+            for status, jobs in (("ok", self.done), ("failed", self.failed)):
+                for job in jobs:
+                    writer.writerow([job.device_id, job.device.address, job.adapter, job.index, status, job.attempts, job.error])
+            for device_id, job in self.jobs.items():
+                if job not in self.done and job not in self.failed:
+                    writer.writerow([device_id, job.device.address, job.adapter, job.index, "pending", job.attempts, job.error])
+        print(f"Report written to {path}")
+
+    def write_leftover(self, path: str) -> None:
+        """Key sets not provisioned: unused ones, and those of failed or pending tags.
+
+        A failed tag may already hold part of its set, so the set stays
+        bound to that tag's device ID and is never handed to another tag.
+        """
+        unfinished = [job for job in self.jobs.values() if job not in self.done]
+        leftover = [replace(job.key_set, device_id=job.device_id) for job in unfinished]
+        leftover += [self.key_sets[i] for i in self.free + list(self.by_id.values())]
+        if not leftover:
+            return
+        write_manifest(path, leftover)
+        print(f"{len(leftover)} key sets not provisioned, written to {path} (rerun with --manifest {path})")
+
+
+async def run_fleet(args) -> None:
+    key_sets = load_manifest(args.manifest)
+    adapters = args.adapters.split(",")
+    fleet = Fleet(args, key_sets)
+    print(f"Fleet: {len(key_sets)} key sets, adapters {', '.join(adapters)}, {args.concurrency} connections each")
+
+    # Every adapter scans, so each one knows the tags its workers connect to
+    workers = [asyncio.create_task(fleet.worker(adapter)) for adapter in adapters for _ in range(args.concurrency)]
+    scanners = [BleakScanner(detection_callback=fleet.on_advertisement, adapter=adapter) for adapter in adapters]
+    start = time.monotonic()
+    try:
+        for scanner in scanners:
+            await scanner.start()
+        await asyncio.wait_for(fleet.finished.wait(), timeout=args.fleet_timeout)
+    except asyncio.TimeoutError:
+        print("Fleet timeout reached")
+    finally:
+        for scanner in scanners:
+            await scanner.stop()
+        for task in workers:
+            task.cancel()
+        await asyncio.gather(*workers, return_exceptions=True)
+        elapsed = time.monotonic() - start
+        print(f"\n{len(fleet.done)} provisioned, {len(fleet.failed)} failed, {fleet.remaining()} left in {elapsed:.0f} s")
+        fleet.write_report(args.report)
+        fleet.write_leftover(args.leftover)
+
+
+async def main() -> None:
+    parser = argparse.ArgumentParser(description="Provision Apple and Google keys over BLE.")
+    parser.add_argument("--name", default="HYBRID-TAG", help="BLE name to match")
+    parser.add_argument("--key", default="WPS9RJBtGkPLvMvFBhvKkofMabkdsdiPzLBSzg==", help="28-byte Apple key (base64)")
+    parser.add_argument("--keyGoogle", default="34aaaffb11e8bf854630bd2ce56fa6b06603b20b", help="20-byte Google key (hex)")
+    parser.add_argument("--eik", help="32-byte Google ephemeral identity key (hex), for CONFIG_TAG_FMDN_EID builds")
+    parser.add_argument("--profile", choices=ADV_PROFILES.keys(), help="Advertising interval profile")
+    parser.add_argument("--quiet", help="Daily quiet hours in local time, e.g. 22:00-06:00 (CONFIG_TAG_QUIET_HOURS)")
+    parser.add_argument("--legacy", action="store_true", help="Write each key to its own characteristic instead of one blob")
+    parser.add_argument("--table", help="Key table image from make_key_table.py to upload over L2CAP first (Linux/BlueZ)")
+    parser.add_argument("--psm", type=lambda x: int(x, 0), default=KEY_UPLOAD_PSM, help="Key table upload PSM (default: 0x80)")
+    parser.add_argument("--list-services", action="store_true", help="Print the GATT services of each tag")
+    parser.add_argument("--no-verify", action="store_true", help="Skip the digest readback (firmware without it)")
+
+    fleet = parser.add_argument_group("fleet mode")
+    fleet.add_argument("--manifest", help="CSV or JSON list of key sets, provisions tags in parallel until all are used")
+    fleet.add_argument("--adapters", default="hci0", help="Comma separated BlueZ adapters, each scans and connects (default: hci0)")
+    fleet.add_argument("--concurrency", type=int, default=3, help="Simultaneous connections per adapter (default: 3)")
+    fleet.add_argument("--retries", type=int, default=3, help="Attempts per tag before it is reported failed (default: 3)")
+    fleet.add_argument("--backoff", type=float, default=2.0, help="First retry delay in seconds, doubles per attempt (default: 2)")
+    fleet.add_argument("--connect-timeout", type=float, default=10.0, help="Connection timeout in seconds (default: 10)")
+    fleet.add_argument("--fleet-timeout", type=float, help="Stop after this many seconds (default: when the manifest is used up)")
+    fleet.add_argument("--report", default="provision_report.csv", help="Result report (default: provision_report.csv)")
+    fleet.add_argument("--leftover", default="provision_leftover.csv", help="Manifest of the key sets not provisioned, failed tags keep theirs (default: provision_leftover.csv)")
+    args = parser.parse_args()
+
+    if args.quiet:
+        try:
+            parse_quiet_hours(args.quiet)
+        except ValueError as e:
+            raise SystemExit(str(e))
+
+    if args.manifest:
+        await run_fleet(args)
+    else:
+        await run_single(args)
 
 
 if __name__ == "__main__":
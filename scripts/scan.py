@@ -1,10 +1,467 @@
 #!/usr/bin/env python3
-"""Scan for AirTags and display their MAC address and public key."""
+"""Scan for AirTags and display their MAC address and public key.
+
+With --bench, decode the tag's Apple FindMy and Google FMDN frames as they
+arrive and report detection latency, gaps at protocol switches and the
+advertising interval seen on air against the configured profile.
+
+With --monitor, match every frame against a provisioning manifest and
+stream the sightings as JSON lines.
+"""
 
 import argparse
+import base64
+import csv
+import json
+import queue
+import shlex
+import statistics
+import struct
+import subprocess
+import sys
+import threading
 import time
 import simplepyble
 
+# Apple FindMy: manufacturer data, see prepare_apple_findmy_adv()
+APPLE_COMPANY_ID = 0x004C
+FINDMY_TYPE = 0x12
+FINDMY_LEN = 0x19
+
+# Google FMDN: Eddystone service data, see prepare_google_fmdn_adv()
+FMDN_UUID = "0000feaa-0000-1000-8000-00805f9b34fb"
+FMDN_FRAME_TYPES = (0x40, 0x41)
+FMDN_EID_SIZE = 20
+
+PROTOCOLS = ("apple", "google")
+
+# Interval ranges in ms per protocol, as in adv_profiles[] in main.c
+ADV_PROFILES = {
+    "fast": {"apple": (100, 150), "google": (100, 150)},
+    "balanced": {"apple": (1000, 1050), "google": (1500, 1550)},
+    "longevity": {"apple": (2000, 2050), "google": (2000, 2050)},
+}
+
+# Mean of the 0-10 ms advDelay the controller adds to every interval
+ADV_DELAY_MEAN_MS = 5
+
+
+def decode_findmy(data: bytes) -> dict | None:
+    """Apple manufacturer data after the company ID: type, length, status, key[6:28], key[0] bits, hint."""
+    if len(data) < 27 or data[0] != FINDMY_TYPE or data[1] != FINDMY_LEN:
+        return None
+    return {
+        "protocol": "apple",
+        "id": data[3:25],
+        "status": data[2],
+        "key_bits": data[25] & 0x03,
+        "hint": data[26],
+    }
+
+
+def decode_fmdn(data: bytes) -> dict | None:
+    """Eddystone service data after the UUID: frame type, EID, hashed flags."""
+    if len(data) < 2 + FMDN_EID_SIZE or data[0] not in FMDN_FRAME_TYPES:
+        return None
+    return {
+        "protocol": "google",
+        "id": data[1:1 + FMDN_EID_SIZE],
+        "flags": data[1 + FMDN_EID_SIZE],
+        "utp": data[0] == 0x41,
+    }
+
+
+def service_data(peripheral) -> dict:
+    """Service data by UUID, from the services simplepyble has seen advertised."""
+    result = {}
+    for service in peripheral.services() if hasattr(peripheral, "services") else []:
+        data = service.data() if hasattr(service, "data") else b""
+        if data:
+            result[service.uuid().lower()] = bytes(data)
+    return result
+
+
+def decode_frames(peripheral) -> list[dict]:
+    frames = []
+    data = peripheral.manufacturer_data().get(APPLE_COMPANY_ID)
+    if data:
+        frame = decode_findmy(bytes(data))
+        if frame:
+            frames.append(frame)
+    data = service_data(peripheral).get(FMDN_UUID)
+    if data:
+        frame = decode_fmdn(data)
+        if frame:
+            frames.append(frame)
+    return frames
+
+
+def percentile(values: list[float], p: float) -> float:
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(len(ordered) * p / 100))]
+
+
+def summarize(values: list[float]) -> dict | None:
+    if not values:
+        return None
+    return {
+        "count": len(values),
+        "min_ms": round(min(values), 1),
+        "median_ms": round(statistics.median(values), 1),
+        "p95_ms": round(percentile(values, 95), 1),
+        "max_ms": round(max(values), 1),
+    }
+
+
+class LatencyBench:
+    """Reception timestamps of one tag, matched by its advertised Apple key bytes or FMDN EID."""
+
+    def __init__(self, apple_id: bytes | None, google_id: bytes | None):
+        self.ids = {"apple": apple_id, "google": google_id}
+        self.lock = threading.Lock()
+        self.receptions = []  # (monotonic time, protocol)
+        self.t0 = time.monotonic()
+
+    def on_peripheral(self, peripheral) -> None:
+        now = time.monotonic()
+        for frame in decode_frames(peripheral):
+            expected = self.ids[frame["protocol"]]
+            # Without a key any tag matches, only sensible with one tag around
+            if expected is not None and frame["id"] != expected:
+                continue
+            with self.lock:
+                self.receptions.append((now, frame["protocol"]))
+
+    def report(self, profile: str | None) -> dict:
+        with self.lock:
+            receptions = [r for r in self.receptions if r[0] >= self.t0]
+
+        result = {"receptions": len(receptions), "protocols": {}}
+        first = {}
+        intervals = {p: [] for p in PROTOCOLS}
+        switch_gaps = []
+        last = None
+        for t, protocol in receptions:
+            first.setdefault(protocol, t)
+            if last is not None:
+                gap = (t - last[0]) * 1000
+                if last[1] == protocol:
+                    intervals[protocol].append(gap)
+                else:
+                    switch_gaps.append(gap)
+            last = (t, protocol)
+
+        for protocol in PROTOCOLS:
+            if protocol not in first:
+                continue
+            stats = {
+                "first_detection_s": round(first[protocol] - self.t0, 3),
+                "interval": summarize(intervals[protocol]),
+            }
+            if profile:
+                lo, hi = ADV_PROFILES[profile][protocol]
+                stats["configured_ms"] = [lo, hi]
+                stats["expected_mean_ms"] = (lo + hi) / 2 + ADV_DELAY_MEAN_MS
+            result["protocols"][protocol] = stats
+
+        if first:
+            result["first_detection_s"] = round(min(first.values()) - self.t0, 3)
+        result["switch_gaps"] = summarize(switch_gaps)
+        return result
+
+
+def print_bench_report(report: dict) -> None:
+    print("=" * 80)
+    print(f"Receptions: {report['receptions']}")
+    if "first_detection_s" not in report:
+        print("Tag not detected")
+        return
+    print(f"First detection: {report['first_detection_s']:.3f} s")
+    for protocol, stats in report["protocols"].items():
+        print(f"\n{protocol}: first seen after {stats['first_detection_s']:.3f} s")
+        interval = stats["interval"]
+        if interval:
+            print(f"  interval: min {interval['min_ms']} / median {interval['median_ms']} / "
+                  f"p95 {interval['p95_ms']} ms over {interval['count']} gaps")
+        if "configured_ms" in stats:
+            lo, hi = stats["configured_ms"]
+            print(f"  configured: {lo}-{hi} ms, expected mean {stats['expected_mean_ms']:.1f} ms on air")
+    gaps = report["switch_gaps"]
+    if gaps:
+        print(f"\nProtocol switches: {gaps['count']}, gap median {gaps['median_ms']} / "
+              f"p95 {gaps['p95_ms']} / max {gaps['max_ms']} ms")
+    print("\nIntervals are between receptions: a missed packet shows up as a multiple, "
+          "so compare the minimum and median.")
+
+
+def run_bench(adapter, args) -> None:
+    apple_id = base64.b64decode(args.key)[6:28] if args.key else None
+    google_id = bytes.fromhex(args.keyGoogle) if args.keyGoogle else None
+    if apple_id is None and google_id is None:
+        print("No --key or --keyGoogle given, taking every FindMy/FMDN frame")
+
+    bench = LatencyBench(apple_id, google_id)
+    adapter.set_callback_on_scan_found(bench.on_peripheral)
+    adapter.set_callback_on_scan_updated(bench.on_peripheral)
+    adapter.scan_start()
+    try:
+        # Latency counts from boot when started by hand, or from the end of --after
+        print("Scanning, reset or provision the tag now..." if not args.after else f"Running: {args.after}")
+        if args.after:
+            subprocess.run(shlex.split(args.after), check=False)
+            bench.t0 = time.monotonic()
+        time.sleep(args.bench_time)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        adapter.scan_stop()
+
+    report = bench.report(args.profile)
+    print_bench_report(report)
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(report, f, indent=2)
+
+
+# Key table image from make_key_table.py (see key_table.h)
+KEY_TABLE_MAGIC = 0x544B5448
+KEY_TABLE_HEADER = struct.Struct("<IHHII")
+APPLE_KEY_SIZE = 28
+
+# Index keys are this many leading bytes of the advertised key or EID
+INDEX_PREFIX = 8
+
+# secp160r1 (SEC 2) and the FMDN EID rotation, as in eid.c
+SECP160R1_P = 0xFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFF7FFFFFFF
+SECP160R1_A = SECP160R1_P - 3
+SECP160R1_N = 0x0100000000000000000001F4C8F927AED3CA752257
+SECP160R1_G = (0x4A96B5688EF573284664698968C38BB913CBFC82, 0x23A628553168947D59DCC912042351377AC5FB32)
+EID_ROTATION_EXPONENT = 10
+EID_ROTATION_PERIOD = 1 << EID_ROTATION_EXPONENT
+
+
+def ec_mul(k: int, point: tuple[int, int]) -> tuple[int, int]:
+    """k * point on secp160r1, affine double-and-add."""
+    result = None
+    addend = point
+    while k:
+        if k & 1:
+            result = ec_add(result, addend)
+        addend = ec_add(addend, addend)
+        k >>= 1
+    return result
+
+
+def ec_add(a, b):
+    p = SECP160R1_P
+    if a is None:
+        return b
+    if b is None:
+        return a
+    if a[0] == b[0]:
+        if (a[1] + b[1]) % p == 0:
+            return None
+        slope = (3 * a[0] * a[0] + SECP160R1_A) * pow(2 * a[1], -1, p) % p
+    else:
+        slope = (b[1] - a[1]) * pow(b[0] - a[0], -1, p) % p
+    x = (slope * slope - a[0] - b[0]) % p
+    return x, (slope * (a[0] - x) - a[1]) % p
+
+
+def compute_eid(eik: bytes, clock: int) -> bytes:
+    """FMDN EID for beacon clock value clock, same steps as eid_compute()."""
+    from cryptography.hazmat.primitives.ciphers import Cipher, algorithms, modes
+
+    ts = clock & ~(EID_ROTATION_PERIOD - 1) & 0xFFFFFFFF
+    block = (b"\xff" * 11 + bytes([EID_ROTATION_EXPONENT]) + ts.to_bytes(4, "big") +
+             b"\x00" * 11 + bytes([EID_ROTATION_EXPONENT]) + ts.to_bytes(4, "big"))
+    encryptor = Cipher(algorithms.AES(eik), modes.ECB()).encryptor()
+    r = int.from_bytes(encryptor.update(block) + encryptor.finalize(), "big") % SECP160R1_N
+    return ec_mul(r, SECP160R1_G)[0].to_bytes(FMDN_EID_SIZE, "big")
+
+
+def load_key_table(path: str) -> list[bytes]:
+    with open(path, "rb") as f:
+        image = f.read()
+    magic, _, key_size, count, _ = KEY_TABLE_HEADER.unpack_from(image)
+    if magic != KEY_TABLE_MAGIC or key_size != APPLE_KEY_SIZE:
+        raise SystemExit(f"{path}: not a key table image")
+    start = KEY_TABLE_HEADER.size
+    return [image[start + i * key_size:start + (i + 1) * key_size] for i in range(count)]
+
+
+class TagIndex:
+    """Advertised key prefix or EID prefix -> (tag, protocol, key slot or EID period).
+
+    Apple entries come from the provisioned key and the keys of the tag's
+    table around its current slot. That slot is predicted from the last slot
+    seen (or table_epoch, Unix time at which the tag was on slot 0) and the
+    rotation period; a tag with neither has its whole table indexed until it
+    is first seen. Google entries are the static key, or for EIK tags with a
+    clock_epoch (Unix time at which the tag's beacon clock was 0) the EIDs
+    of the periods around now.
+
+    refresh() builds a new dict and swaps it in with one assignment, so the
+    scan callback thread always looks up in a complete index without a lock.
+    """
+
+    def __init__(self, window: int, key_window: int, key_period: float):
+        self.window = window
+        self.key_window = key_window
+        self.key_period = key_period
+        self.tags = []
+        self.entries = {}
+        self.static_entries = {}
+        self.key_tables = []  # (tag number, keys)
+        self.key_anchors = {}  # tag number -> (slot, time it was current)
+        self.eid_tags = []  # (tag number, eik, clock_epoch)
+        self.eid_cache = {}  # tag number -> {period: eid}, refresh() only
+
+    def lookup(self, frame: dict):
+        return self.entries.get(frame["id"][:INDEX_PREFIX])
+
+    def seen(self, tag: int, protocol: str, slot: int, now: float) -> None:
+        """Called from the scan thread, moves the tag's table window with the next refresh()."""
+        if protocol == "apple" and slot >= 0:
+            self.key_anchors[tag] = (slot, now)
+
+    def load(self, path: str) -> None:
+        """Same manifest as provision_keys.py, plus optional tag, table_epoch and clock_epoch fields."""
+        with open(path, newline="") as f:
+            rows = json.load(f) if path.endswith(".json") else list(csv.DictReader(f))
+
+        for n, row in enumerate(rows, 1):
+            tag = len(self.tags)
+            self.tags.append(row.get("tag") or row.get("device_id") or f"#{n}")
+            apple_key = base64.b64decode(row["apple_key"])
+            self.static_entries[apple_key[6:28][:INDEX_PREFIX]] = (tag, "apple", -1)
+            if row.get("table"):
+                self.key_tables.append((tag, load_key_table(row["table"])))
+                if row.get("table_epoch"):
+                    self.key_anchors[tag] = (0, float(row["table_epoch"]))
+
+            if row.get("eik") and row.get("clock_epoch"):
+                self.eid_tags.append((tag, bytes.fromhex(row["eik"]), float(row["clock_epoch"])))
+            elif row.get("google_key"):
+                self.static_entries[bytes.fromhex(row["google_key"])[:INDEX_PREFIX]] = (tag, "google", -1)
+
+    def table_slots(self, tag: int, count: int, now: float):
+        anchor = self.key_anchors.get(tag)
+        if anchor is None:
+            return range(count)
+        slot, since = anchor
+        current = slot + int((now - since) // self.key_period)
+        if 2 * self.key_window + 1 >= count:
+            return range(count)
+        return (s % count for s in range(current - self.key_window, current + self.key_window + 1))
+
+    def refresh(self, now: float) -> None:
+        """Rebuild the index around now: table keys near each current slot, EIDs near each period."""
+        entries = dict(self.static_entries)
+
+        for tag, keys in self.key_tables:
+            for slot in self.table_slots(tag, len(keys), now):
+                entries[keys[slot][6:28][:INDEX_PREFIX]] = (tag, "apple", slot)
+
+        for tag, eik, epoch in self.eid_tags:
+            current = int(now - epoch) >> EID_ROTATION_EXPONENT
+            wanted = range(max(current - self.window, 0), current + self.window + 1)
+            cache = self.eid_cache.get(tag, {})
+            cache = {period: cache.get(period) or compute_eid(eik, period << EID_ROTATION_EXPONENT)
+                     for period in wanted}
+            self.eid_cache[tag] = cache
+            for period, eid in cache.items():
+                entries[eid[:INDEX_PREFIX]] = (tag, "google", period)
+
+        self.entries = entries
+
+
+class SightingStream:
+    """Decode frames in the scan callback, write JSON lines from a writer thread.
+
+    The queue between them is bounded: when the writer falls behind,
+    sightings are dropped and counted rather than buffered.
+    """
+
+    def __init__(self, index: TagIndex, out, min_interval: float, unmatched: bool, queue_size: int):
+        self.index = index
+        self.out = out
+        self.min_interval = min_interval
+        self.unmatched = unmatched
+        self.queue = queue.Queue(maxsize=queue_size)
+        self.last_seen = {}  # (tag, protocol) -> time, bounded by the manifest
+        self.dropped = 0
+        self.written = 0
+        self.running = True
+
+    def on_peripheral(self, peripheral) -> None:
+        now = time.time()
+        for frame in decode_frames(peripheral):
+            match = self.index.lookup(frame)
+            if match is None:
+                if not self.unmatched:
+                    continue
+                sighting = {"ts": round(now, 3), "protocol": frame["protocol"], "id": frame["id"].hex()}
+            else:
+                tag, protocol, slot = match
+                key = (tag, protocol)
+                if now - self.last_seen.get(key, 0.0) < self.min_interval:
+                    continue
+                self.last_seen[key] = now
+                self.index.seen(tag, protocol, slot, now)
+                sighting = {"ts": round(now, 3), "tag": self.index.tags[tag], "protocol": protocol}
+                if slot >= 0:
+                    sighting["slot" if protocol == "apple" else "eid_period"] = slot
+            sighting["rssi"] = peripheral.rssi()
+            sighting["addr"] = peripheral.address()
+            try:
+                self.queue.put_nowait(sighting)
+            except queue.Full:
+                self.dropped += 1
+
+    def write(self) -> None:
+        while self.running or not self.queue.empty():
+            try:
+                sighting = self.queue.get(timeout=0.5)
+            except queue.Empty:
+                self.out.flush()
+                continue
+            self.out.write(json.dumps(sighting) + "\n")
+            self.written += 1
+
+
+def run_monitor(adapter, args) -> None:
+    index = TagIndex(args.eid_window, args.key_window, args.key_period * 60)
+    index.load(args.manifest)
+    index.refresh(time.time())
+    print(f"{len(index.tags)} tags, {len(index.entries)} keys indexed", file=sys.stderr)
+
+    out = open(args.out, "a") if args.out else sys.stdout
+    stream = SightingStream(index, out, args.min_interval, args.unmatched, args.queue_size)
+    writer = threading.Thread(target=stream.write, daemon=True)
+    writer.start()
+
+    adapter.set_callback_on_scan_found(stream.on_peripheral)
+    adapter.set_callback_on_scan_updated(stream.on_peripheral)
+    adapter.scan_start()
+    try:
+        # Scanning never pauses, the loop only moves the key and EID windows along
+        while True:
+            time.sleep(min(EID_ROTATION_PERIOD, args.key_period * 60) / 4)
+            index.refresh(time.time())
+            if stream.dropped:
+                print(f"{stream.dropped} sightings dropped so far", file=sys.stderr)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        adapter.scan_stop()
+        stream.running = False
+        writer.join()
+        print(f"{stream.written} sightings written, {stream.dropped} dropped", file=sys.stderr)
+        if out is not sys.stdout:
+            out.close()
+
+
 def main() -> None:
     parser = argparse.ArgumentParser(description="Scan for AirTags and display MAC/public key.")
     parser.add_argument("--duration", type=int, default=10000, help="Scan duration in ms (default: 8000)")
@@ -12,13 +469,43 @@ def main() -> None:
     parser.add_argument("--cid", nargs='*', default=[0xfff1, 0xfff2, 0xfff3], type=lambda x: int(x, 0), help="Filter by company IDs (e.g., --cid 0x004C 0x12fa)")
     parser.add_argument("--name", default='hybrid', type=str, help="Include devices matching this name (substring match)")
     parser.add_argument("--continuous", default=1, action="store_true", help="Scan continuously")
+
+    bench = parser.add_argument_group("detection benchmark")
+    bench.add_argument("--bench", action="store_true", help="Measure detection latency and intervals of one tag")
+    bench.add_argument("--key", help="Apple key of the tag (base64), matches its FindMy frames")
+    bench.add_argument("--keyGoogle", help="Google key of the tag (hex), matches its static-EID FMDN frames")
+    bench.add_argument("--profile", choices=ADV_PROFILES.keys(), help="Configured interval profile to compare against")
+    bench.add_argument("--bench-time", type=float, default=60.0, help="Seconds to record (default: 60)")
+    bench.add_argument("--after", help="Command to run first (e.g. provisioning), latency counts from its exit")
+    bench.add_argument("--json", help="Write the benchmark report as JSON")
+
+    monitor = parser.add_argument_group("fleet monitor")
+    monitor.add_argument("--monitor", action="store_true", help="Stream sightings of manifest tags as JSON lines")
+    monitor.add_argument("--manifest", help="provision_keys.py manifest, optional tag, table_epoch and clock_epoch fields")
+    monitor.add_argument("--out", help="Append sightings to this file (default: stdout)")
+    monitor.add_argument("--min-interval", type=float, default=0.0, help="Seconds between sightings per tag and protocol (default: 0)")
+    monitor.add_argument("--eid-window", type=int, default=2, help="EID periods indexed either side of now (default: 2)")
+    monitor.add_argument("--key-window", type=int, default=8, help="Key table slots indexed either side of the current one (default: 8)")
+    monitor.add_argument("--key-period", type=float, default=15.0, help="Key rotation period in minutes, CONFIG_TAG_KEY_ROTATION_PERIOD_MIN (default: 15)")
+    monitor.add_argument("--unmatched", action="store_true", help="Also write frames that match no tag")
+    monitor.add_argument("--queue-size", type=int, default=10000, help="Sightings buffered for the writer (default: 10000)")
     args = parser.parse_args()
 
+    if args.monitor and not args.manifest:
+        parser.error("--monitor needs --manifest")
+
     adapters = simplepyble.Adapter.get_adapters()
     if not adapters:
         raise SystemExit("No BLE adapters found")
     adapter = adapters[0]
 
+    if args.bench:
+        run_bench(adapter, args)
+        return
+    if args.monitor:
+        run_monitor(adapter, args)
+        return
+
     print(f"Scanning (RSSI > {args.rssi} dBm)...")
     print("=" * 80)
 
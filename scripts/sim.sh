@@ -0,0 +1,52 @@
+#!/bin/bash
+set -e
+
+# Usage: ./sim.sh [nrf52_bsim|native_sim] [seconds]
+# Examples:
+#   ./sim.sh nrf52_bsim 120   # 120 s of simulated time in BabbleSim (BSIM_OUT_PATH set)
+#   ./sim.sh native_sim       # Run on this machine against the controller on hci0
+#   HCI_DEV=hci1 ./sim.sh native_sim
+#
+# State transitions are logged with their uptime, so repeated bsim runs
+# give directly comparable timings.
+# The ztest suites asserting those timings run with ./test.sh.
+
+TARGET=${1:-"nrf52_bsim"}
+SIM_SECONDS=${2:-60}
+HCI_DEV=${HCI_DEV:-"hci0"}
+BUILD_DIR="build_${TARGET}"
+
+source ../ncs/export_env.sh
+
+echo "========================================"
+echo "  Simulation target: ${TARGET}"
+echo "========================================"
+
+cd ../ncs
+
+west build -p always -b "${TARGET}" -d "${BUILD_DIR}" -s ..
+
+if [ "${TARGET}" == "native_sim" ]; then
+  # The HCI user channel needs the adapter down and CAP_NET_ADMIN
+  sudo hciconfig "${HCI_DEV}" down || true
+  sudo "${BUILD_DIR}/zephyr/zephyr.exe" --bt-dev="${HCI_DEV}"
+
+elif [ "${TARGET}" == "nrf52_bsim" ]; then
+  if [ -z "${BSIM_OUT_PATH}" ]; then
+    echo "Error: BSIM_OUT_PATH not set (see the BabbleSim install docs)"
+    exit 1
+  fi
+
+  EXE="bs_nrf52_bsim_hybrid_tag"
+  cp "${BUILD_DIR}/zephyr/zephyr.exe" "${BSIM_OUT_PATH}/bin/${EXE}"
+  cd "${BSIM_OUT_PATH}/bin"
+
+  ./${EXE} -s=hybrid_tag -d=0 &
+  TAG_PID=$!
+  ./bs_2G4_phy_v1 -s=hybrid_tag -D=1 -sim_length=$((SIM_SECONDS * 1000000))
+  wait ${TAG_PID}
+else
+  echo "Error: Unknown target '${TARGET}'"
+  echo "Usage: $0 [nrf52_bsim|native_sim] [seconds]"
+  exit 1
+fi
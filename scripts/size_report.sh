@@ -0,0 +1,63 @@
+#!/bin/bash
+set -eo pipefail
+
+# Usage: ./size_report.sh [board]
+# Examples:
+#   ./size_report.sh                      # nrf52dk/nrf52832
+#   ./size_report.sh nrf52dk/nrf52810     # Check the beacon-only image fits
+#
+# Builds every provisioning variant and prints its flash and RAM use:
+#   full    GATT config service and scan provisioning (prj.conf)
+#   gatt    GATT config service only
+#   scan    Scan provisioning only
+#   beacon  Keys built in, no provisioning (prj.beacon.conf)
+# The rom_report and ram_report of each variant are left in
+# build_size_<variant>/ for a per-symbol breakdown.
+
+BOARD=${1:-"nrf52dk/nrf52832"}
+VARIANTS=(full gatt scan beacon)
+
+# Only the image size matters, all-zero keys are fine
+ZERO_APPLE_KEY=$(printf '0%.0s' {1..56})
+ZERO_GOOGLE_KEY=$(printf '0%.0s' {1..40})
+
+source ../ncs/export_env.sh
+
+cd ../ncs
+
+variant_args() {
+  case "$1" in
+    full) ;;
+    gatt) echo "-DCONFIG_TAG_PROV_SCAN=n" ;;
+    scan) echo "-DCONFIG_TAG_PROV_GATT=n" ;;
+    beacon)
+      echo "-DEXTRA_CONF_FILE=prj.beacon.conf"
+      echo "-DCONFIG_TAG_BUILTIN_APPLE_KEY=\"${ZERO_APPLE_KEY}\""
+      echo "-DCONFIG_TAG_BUILTIN_GOOGLE_KEY=\"${ZERO_GOOGLE_KEY}\""
+      ;;
+  esac
+}
+
+declare -A FLASH_USED RAM_USED
+for VARIANT in "${VARIANTS[@]}"; do
+  BUILD_DIR="build_size_${VARIANT}"
+  mapfile -t ARGS < <(variant_args "${VARIANT}")
+
+  echo "=== ${VARIANT} ==="
+  west build -p always -b "${BOARD}" -d "${BUILD_DIR}" -s .. -- "${ARGS[@]}" \
+    | tee "${BUILD_DIR}.log"
+
+  # Memory usage summary printed by the linker
+  FLASH_USED[${VARIANT}]=$(awk '$1 == "FLASH:" { print $2 }' "${BUILD_DIR}.log")
+  RAM_USED[${VARIANT}]=$(awk '$1 == "RAM:" { print $2 }' "${BUILD_DIR}.log")
+
+  west build -d "${BUILD_DIR}" -t rom_report > "${BUILD_DIR}/rom_report.txt"
+  west build -d "${BUILD_DIR}" -t ram_report > "${BUILD_DIR}/ram_report.txt"
+done
+
+echo ""
+echo "Board: ${BOARD}"
+printf "%-8s %12s %12s\n" "variant" "flash (B)" "RAM (B)"
+for VARIANT in "${VARIANTS[@]}"; do
+  printf "%-8s %12s %12s\n" "${VARIANT}" "${FLASH_USED[${VARIANT}]}" "${RAM_USED[${VARIANT}]}"
+done
@@ -0,0 +1,68 @@
+#!/bin/bash
+set -e
+
+# Usage: ./test.sh [all|native_sim|nrf52_bsim] [seconds]
+# Examples:
+#   ./test.sh                 # Both targets (BSIM_OUT_PATH set)
+#   ./test.sh native_sim      # Payload and scan frame suites only, no BabbleSim needed
+#   ./test.sh nrf52_bsim 120  # Every suite, 120 s of simulated time at most
+#
+# The ztest suites are in tests/. On nrf52_bsim the tag runs against the
+# 2G4 phy next to the observer (tests/observer), once with each advertiser,
+# so the advertising schedule timings are simulated and repeatable.
+
+TARGET=${1:-"all"}
+SIM_SECONDS=${2:-120}
+OUT_DIR="twister-out"
+
+if [ "${TARGET}" != "all" ] && [ "${TARGET}" != "native_sim" ] && [ "${TARGET}" != "nrf52_bsim" ]; then
+  echo "Error: Unknown target '${TARGET}'"
+  echo "Usage: $0 [all|native_sim|nrf52_bsim] [seconds]"
+  exit 1
+fi
+
+source ../ncs/export_env.sh
+
+echo "========================================"
+echo "  Test target: ${TARGET}"
+echo "========================================"
+
+cd ../ncs
+
+if [ "${TARGET}" == "all" ] || [ "${TARGET}" == "native_sim" ]; then
+  west twister -T ../tests -p native_sim -O "${OUT_DIR}_native_sim" --inline-logs
+fi
+
+if [ "${TARGET}" == "all" ] || [ "${TARGET}" == "nrf52_bsim" ]; then
+  if [ -z "${BSIM_OUT_PATH}" ]; then
+    echo "Error: BSIM_OUT_PATH not set (see the BabbleSim install docs)"
+    exit 1
+  fi
+
+  # Twister builds and copies the executable, the phy is started here
+  west twister -T ../tests -p nrf52_bsim -O "${OUT_DIR}_nrf52_bsim" --inline-logs
+
+  # Each tag build runs as device 0 with the observer counting its PDUs as device 1
+  RESULTS="${PWD}/${OUT_DIR}_nrf52_bsim"
+  cd "${BSIM_OUT_PATH}/bin"
+
+  for SIM in hybrid_tag_tests hybrid_tag_tests_ext_adv hybrid_tag_tests_key_table; do
+    LOG="${RESULTS}/${SIM}.log"
+
+    ./bs_nrf52_bsim_${SIM} -s=${SIM} -d=0 > "${LOG}" 2>&1 &
+    TAG_PID=$!
+    ./bs_nrf52_bsim_hybrid_tag_observer -s=${SIM} -d=1 > "${RESULTS}/${SIM}_observer.log" 2>&1 &
+    OBSERVER_PID=$!
+    ./bs_2G4_phy_v1 -s=${SIM} -D=2 -sim_length=$((SIM_SECONDS * 1000000))
+    TAG_STATUS=0
+    wait ${TAG_PID} || TAG_STATUS=$?
+    wait ${OBSERVER_PID} || true
+    cat "${LOG}"
+    if [ ${TAG_STATUS} -ne 0 ]; then
+      exit ${TAG_STATUS}
+    fi
+
+    # The run also ends when the phy does, only a complete pass counts
+    grep -q "PROJECT EXECUTION SUCCESSFUL" "${LOG}"
+  done
+fi
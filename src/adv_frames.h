@@ -0,0 +1,78 @@
+#ifndef ADV_FRAMES_H
+#define ADV_FRAMES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/toolchain.h>
+#include <zephyr/bluetooth/gap.h>
+
+/*
+ * Beacon frame layouts. Each frame is a struct of byte fields, so it has
+ * no padding and the struct itself is the layout: sizes and offsets
+ * follow from it and are checked below. The _INIT templates hold every
+ * constant byte and initialize the payload buffers at build time, the
+ * builders only write the fields marked as runtime.
+ */
+
+/*
+ * Apple FindMy offline finding frame, sent as manufacturer data. The
+ * public key's first 6 bytes go out as the address, the frame carries
+ * the other 22 and the top two bits of byte 0.
+ */
+struct apple_findmy_frame {
+    uint8_t company[2];     /* Apple, 0x004C little endian */
+    uint8_t type;           /* APPLE_FINDMY_TYPE_OFFLINE_FINDING */
+    uint8_t length;         /* Bytes after this one */
+    uint8_t status;         /* Runtime: battery level in bits 6-7 */
+    uint8_t key[22];        /* Runtime: public key bytes 6-27 */
+    uint8_t key_bits;       /* Runtime: public key byte 0 bits 6-7 */
+    uint8_t hint;
+};
+
+#define APPLE_FINDMY_TYPE_OFFLINE_FINDING 0x12
+#define APPLE_FINDMY_KEY_OFFSET 6
+#define APPLE_FINDMY_PAYLOAD_SIZE sizeof(struct apple_findmy_frame)
+
+#define APPLE_FINDMY_FRAME_INIT {                                                   \
+    .company = { 0x4C, 0x00 },                                                      \
+    .type = APPLE_FINDMY_TYPE_OFFLINE_FINDING,                                      \
+    .length = APPLE_FINDMY_PAYLOAD_SIZE - offsetof(struct apple_findmy_frame, status), \
+}
+
+BUILD_ASSERT(APPLE_FINDMY_PAYLOAD_SIZE == 29, "Apple FindMy frame is 29 bytes");
+BUILD_ASSERT(offsetof(struct apple_findmy_frame, status) == 4, "Apple status at [4]");
+BUILD_ASSERT(offsetof(struct apple_findmy_frame, key) == 5, "Apple key at [5-26]");
+BUILD_ASSERT(offsetof(struct apple_findmy_frame, key_bits) == 27, "Apple key bits at [27]");
+BUILD_ASSERT(offsetof(struct apple_findmy_frame, hint) == 28, "Apple hint at [28]");
+/* Alone in the advertising data, behind its 2-byte AD header */
+BUILD_ASSERT(2 + APPLE_FINDMY_PAYLOAD_SIZE <= BT_GAP_ADV_MAX_ADV_DATA_LEN,
+             "Apple FindMy frame exceeds legacy advertising data");
+
+/*
+ * Google FMDN frame, sent as Eddystone service data, see
+ * https://developers.google.com/nearby/fast-pair/specifications/extensions/fmdn#advertised-frames
+ */
+struct google_fmdn_frame {
+    uint8_t uuid[2];        /* Eddystone, 0xFEAA little endian */
+    uint8_t type;           /* GOOGLE_FMDN_TYPE_FHN, or _UTP once that mode exists */
+    uint8_t eid[20];        /* Runtime: ephemeral identifier, per rotation */
+    uint8_t flags;          /* Runtime: hashed flags, battery level in bits 5-6 */
+};
+
+#define GOOGLE_FMDN_TYPE_FHN 0x40
+#define GOOGLE_FMDN_TYPE_UTP 0x41   /* Unwanted tracking protection mode */
+#define GOOGLE_FMDN_PAYLOAD_SIZE sizeof(struct google_fmdn_frame)
+
+#define GOOGLE_FMDN_FRAME_INIT {                                                    \
+    .uuid = { 0xAA, 0xFE },                                                         \
+    .type = GOOGLE_FMDN_TYPE_FHN,                                                   \
+}
+
+BUILD_ASSERT(GOOGLE_FMDN_PAYLOAD_SIZE == 24, "Google FMDN frame is 24 bytes");
+BUILD_ASSERT(offsetof(struct google_fmdn_frame, eid) == 3, "FMDN EID at [3-22]");
+BUILD_ASSERT(offsetof(struct google_fmdn_frame, flags) == 23, "FMDN flags at [23]");
+/* Behind the 3-byte flags AD and its own 2-byte AD header */
+BUILD_ASSERT(3 + 2 + GOOGLE_FMDN_PAYLOAD_SIZE <= BT_GAP_ADV_MAX_ADV_DATA_LEN,
+             "Google FMDN frame exceeds legacy advertising data");
+
+#endif /* ADV_FRAMES_H */
@@ -0,0 +1,135 @@
+/* battery.c - Cached battery level from periodic SAADC samples of VDD */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/adc.h>
+#include <zephyr/dt-bindings/adc/nrf-saadc.h>
+#include <zephyr/logging/log.h>
+
+#include "battery.h"
+#include "tag_work.h"
+
+LOG_MODULE_REGISTER(battery, CONFIG_TAG_LOG_LEVEL);
+
+#define BATTERY_ADC_CHANNEL 0
+#define BATTERY_ADC_RESOLUTION 12
+#define BATTERY_ADC_GAIN ADC_GAIN_1_6
+
+/* First sample once the boot flash and radio work has settled */
+#define BATTERY_FIRST_SAMPLE_DELAY K_SECONDS(30)
+
+/* Margin to climb back a level, so a voltage on a boundary does not flap */
+#define BATTERY_HYSTERESIS_MV 50
+
+/* Lower bound of each bucket for a 3 V lithium cell, below the last is critical */
+static const struct {
+	enum battery_level level;
+	int32_t min_mv;
+} battery_thresholds[] = {
+	{ BATTERY_LEVEL_FULL, 2900 },
+	{ BATTERY_LEVEL_MEDIUM, 2700 },
+	{ BATTERY_LEVEL_LOW, 2500 },
+};
+
+static const struct device *const adc = DEVICE_DT_GET(DT_NODELABEL(adc));
+
+static const struct adc_channel_cfg battery_channel = {
+	.gain = BATTERY_ADC_GAIN,
+	.reference = ADC_REF_INTERNAL,
+	.acquisition_time = ADC_ACQ_TIME(ADC_ACQ_TIME_MICROSECONDS, 10),
+	.channel_id = BATTERY_ADC_CHANNEL,
+	.input_positive = NRF_SAADC_VDD,
+};
+
+static battery_handler_t battery_handler;
+static enum battery_level battery_level = BATTERY_LEVEL_UNKNOWN;
+
+static void battery_work_handler(struct k_work *work);
+
+K_WORK_DELAYABLE_DEFINE(battery_work, battery_work_handler);
+
+static int battery_sample_mv(int32_t *mv)
+{
+	int16_t sample;
+	const struct adc_sequence sequence = {
+		.channels = BIT(BATTERY_ADC_CHANNEL),
+		.buffer = &sample,
+		.buffer_size = sizeof(sample),
+		.resolution = BATTERY_ADC_RESOLUTION,
+		.oversampling = 2,
+	};
+	int err;
+
+	err = adc_read(adc, &sequence);
+	if (err) {
+		return err;
+	}
+
+	*mv = sample;
+	return adc_raw_to_millivolts(adc_ref_internal(adc), BATTERY_ADC_GAIN,
+				     BATTERY_ADC_RESOLUTION, mv);
+}
+
+static enum battery_level battery_level_from_mv(int32_t mv)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(battery_thresholds); i++) {
+		int32_t min_mv = battery_thresholds[i].min_mv;
+
+		/* Moving to a better level than the current one needs the margin */
+		if (battery_level != BATTERY_LEVEL_UNKNOWN &&
+		    battery_thresholds[i].level < battery_level) {
+			min_mv += BATTERY_HYSTERESIS_MV;
+		}
+		if (mv >= min_mv) {
+			return battery_thresholds[i].level;
+		}
+	}
+	return BATTERY_LEVEL_CRITICAL;
+}
+
+static void battery_work_handler(struct k_work *work)
+{
+	enum battery_level level;
+	int32_t mv;
+	int err;
+
+	k_work_schedule_for_queue(&tag_work_q, &battery_work,
+				  K_MINUTES(CONFIG_TAG_BATTERY_PERIOD_MIN));
+
+	err = battery_sample_mv(&mv);
+	if (err) {
+		LOG_WRN("Battery sample failed (err %d)", err);
+		return;
+	}
+
+	level = battery_level_from_mv(mv);
+	LOG_DBG("Battery %d mV, level %d", mv, level);
+	if (level != battery_level) {
+		battery_level = level;
+		LOG_INF("Battery level %d (%d mV)", level, mv);
+		battery_handler(level);
+	}
+}
+
+int battery_init(battery_handler_t handler)
+{
+	int err;
+
+	if (!device_is_ready(adc)) {
+		return -ENODEV;
+	}
+
+	err = adc_channel_setup(adc, &battery_channel);
+	if (err) {
+		return err;
+	}
+
+	battery_handler = handler;
+	k_work_schedule_for_queue(&tag_work_q, &battery_work, BATTERY_FIRST_SAMPLE_DELAY);
+	return 0;
+}
@@ -0,0 +1,23 @@
+#ifndef BATTERY_H
+#define BATTERY_H
+
+/* Battery level buckets, as reported by both networks */
+enum battery_level {
+    BATTERY_LEVEL_UNKNOWN,
+    BATTERY_LEVEL_FULL,
+    BATTERY_LEVEL_MEDIUM,
+    BATTERY_LEVEL_LOW,
+    BATTERY_LEVEL_CRITICAL,
+};
+
+/*
+ * VDD is sampled with the SAADC every CONFIG_TAG_BATTERY_PERIOD_MIN on
+ * tag_work_q. The handler runs there too, and only when the bucket
+ * changes, so advertising code just reads the cached level.
+ */
+typedef void (*battery_handler_t)(enum battery_level level);
+
+/* Set up the ADC channel and schedule the first sample */
+int battery_init(battery_handler_t handler);
+
+#endif /* BATTERY_H */
@@ -0,0 +1,50 @@
+/* bench.c - GPIO phase markers for energy measurements */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/drivers/gpio.h>
+
+#include "bench.h"
+
+#define BENCH_NODE DT_PATH(zephyr_user)
+
+BUILD_ASSERT(DT_PROP_LEN(BENCH_NODE, bench_gpios) == 3,
+	     "bench-gpios needs two state pins and one protocol pin");
+
+static const struct gpio_dt_spec bench_pins[] = {
+	GPIO_DT_SPEC_GET_BY_IDX(BENCH_NODE, bench_gpios, 0),
+	GPIO_DT_SPEC_GET_BY_IDX(BENCH_NODE, bench_gpios, 1),
+	GPIO_DT_SPEC_GET_BY_IDX(BENCH_NODE, bench_gpios, 2),
+};
+
+void bench_mark_state(unsigned int state)
+{
+	gpio_pin_set_dt(&bench_pins[0], state & BIT(0));
+	gpio_pin_set_dt(&bench_pins[1], state & BIT(1));
+}
+
+void bench_mark_protocol(unsigned int protocol)
+{
+	gpio_pin_set_dt(&bench_pins[2], protocol);
+}
+
+int bench_init(void)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(bench_pins); i++) {
+		if (!gpio_is_ready_dt(&bench_pins[i])) {
+			return -ENODEV;
+		}
+
+		const int err = gpio_pin_configure_dt(&bench_pins[i], GPIO_OUTPUT_INACTIVE);
+
+		if (err) {
+			return err;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,15 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/*
+ * GPIO phase markers for current measurements (scripts/energy_bench.py).
+ * The bench-gpios of the zephyr,user node carry, in order:
+ *   [0-1]: lifecycle state (tag_state_t value, bit 0 first)
+ *   [2]:   protocol on air with a single advertiser (0 Apple, 1 Google)
+ * Wire them to the PPK2 logic port D0-D2 (or the Otii GPI inputs).
+ */
+int bench_init(void);
+void bench_mark_state(unsigned int state);
+void bench_mark_protocol(unsigned int protocol);
+
+#endif /* BENCH_H */
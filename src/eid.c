@@ -0,0 +1,125 @@
+/* eid.c - FMDN ephemeral identifier computation */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+#include <string.h>
+#include <psa/crypto.h>
+
+#include "eid.h"
+#include "secp160r1.h"
+
+BUILD_ASSERT(EID_SIZE == SECP160R1_FIELD_SIZE, "EID is a secp160r1 x coordinate");
+
+int eid_init(void)
+{
+	const psa_status_t status = psa_crypto_init();
+
+	return status == PSA_SUCCESS ? 0 : -EIO;
+}
+
+/* a >= b for big-endian numbers of the group order size */
+static bool ge_n(const uint8_t a[sizeof(secp160r1_n)])
+{
+	for (size_t i = 0; i < sizeof(secp160r1_n); i++) {
+		if (a[i] != secp160r1_n[i]) {
+			return a[i] > secp160r1_n[i];
+		}
+	}
+	return true;
+}
+
+static void sub_n(uint8_t a[sizeof(secp160r1_n)])
+{
+	int borrow = 0;
+
+	for (int i = sizeof(secp160r1_n) - 1; i >= 0; i--) {
+		const int d = a[i] - secp160r1_n[i] - borrow;
+
+		a[i] = (uint8_t)d;
+		borrow = d < 0;
+	}
+}
+
+/* r = x mod n, bit by bit. Runs once per rotation on 32 bytes, cost is negligible. */
+static void reduce_mod_n(const uint8_t x[32], uint8_t r[sizeof(secp160r1_n)])
+{
+	memset(r, 0, sizeof(secp160r1_n));
+
+	for (int bit = 0; bit < 256; bit++) {
+		int carry = (x[bit / 8] >> (7 - bit % 8)) & 1;
+
+		for (int i = sizeof(secp160r1_n) - 1; i >= 0; i--) {
+			const int v = (r[i] << 1) | carry;
+
+			r[i] = (uint8_t)v;
+			carry = v >> 8;
+		}
+		/* r < n before the shift, so 2r + 1 < 2n and one subtraction is enough */
+		if (carry || ge_n(r)) {
+			sub_n(r);
+		}
+	}
+}
+
+static int aes256_ecb(const uint8_t key[EIK_SIZE], const uint8_t in[32], uint8_t out[32])
+{
+	psa_key_attributes_t attr = PSA_KEY_ATTRIBUTES_INIT;
+	psa_key_id_t key_id;
+	psa_status_t status;
+	size_t out_len;
+
+	psa_set_key_usage_flags(&attr, PSA_KEY_USAGE_ENCRYPT);
+	psa_set_key_lifetime(&attr, PSA_KEY_LIFETIME_VOLATILE);
+	psa_set_key_algorithm(&attr, PSA_ALG_ECB_NO_PADDING);
+	psa_set_key_type(&attr, PSA_KEY_TYPE_AES);
+	psa_set_key_bits(&attr, 256);
+
+	status = psa_import_key(&attr, key, EIK_SIZE, &key_id);
+	if (status != PSA_SUCCESS) {
+		return -EIO;
+	}
+
+	status = psa_cipher_encrypt(key_id, PSA_ALG_ECB_NO_PADDING, in, 32, out, 32, &out_len);
+	psa_destroy_key(key_id);
+
+	return (status == PSA_SUCCESS && out_len == 32) ? 0 : -EIO;
+}
+
+int eid_compute(const uint8_t eik[EIK_SIZE], uint32_t clock, uint8_t eid[EID_SIZE])
+{
+	/*
+	 * Input block:
+	 *   [0-10]:  Padding 0xFF - 11 bytes
+	 *   [11]:    K - 1 byte
+	 *   [12-15]: TS with the lowest K bits cleared (big-endian) - 4 bytes
+	 *   [16-26]: Padding 0x00 - 11 bytes
+	 *   [27]:    K - 1 byte
+	 *   [28-31]: TS with the lowest K bits cleared (big-endian) - 4 bytes
+	 */
+	const uint32_t ts = clock & ~(EID_ROTATION_PERIOD_SEC - 1);
+	uint8_t block[32];
+	uint8_t r_prime[32];
+	uint8_t r[sizeof(secp160r1_n)];
+	int err;
+
+	memset(&block[0], 0xff, 11);
+	block[11] = EID_ROTATION_EXPONENT;
+	sys_put_be32(ts, &block[12]);
+	memset(&block[16], 0x00, 11);
+	block[27] = EID_ROTATION_EXPONENT;
+	sys_put_be32(ts, &block[28]);
+
+	err = aes256_ecb(eik, block, r_prime);
+	if (err) {
+		return err;
+	}
+
+	reduce_mod_n(r_prime, r);
+
+	/* r = 0 (probability ~2^-160) has no point, mul_base_x rejects it */
+	return secp160r1_mul_base_x(r, eid);
+}
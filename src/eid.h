@@ -0,0 +1,28 @@
+#ifndef EID_H
+#define EID_H
+
+#include <stdint.h>
+
+/* Ephemeral identity key provisioned for FMDN (AES-256) */
+#define EIK_SIZE 32
+
+/* Ephemeral identifier: x coordinate of a secp160r1 point */
+#define EID_SIZE 20
+
+/* EID rotates every 2^K seconds of the beacon clock (K = 10, 1024 s) */
+#define EID_ROTATION_EXPONENT 10
+#define EID_ROTATION_PERIOD_SEC (1U << EID_ROTATION_EXPONENT)
+
+/* Initialize the PSA crypto backend */
+int eid_init(void);
+
+/*
+ * Compute the EID for the rotation period containing beacon clock value
+ * clock, per the FMDN specification:
+ *   r' = AES-ECB-256(EIK, pad(K, TS))
+ *   r  = r' mod n
+ *   EID = x(r * G) on secp160r1
+ */
+int eid_compute(const uint8_t eik[EIK_SIZE], uint32_t clock, uint8_t eid[EID_SIZE]);
+
+#endif /* EID_H */
@@ -0,0 +1,60 @@
+/* key_table.c - Flash-resident Apple FindMy key table */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/logging/log.h>
+
+#include "key_table.h"
+
+LOG_MODULE_REGISTER(key_table, CONFIG_TAG_LOG_LEVEL);
+
+#define KEY_TABLE_PARTITION key_table_partition
+
+/* Internal flash is memory mapped, keys are read in place */
+static const uint8_t *const key_table_base =
+	(const uint8_t *)(CONFIG_FLASH_BASE_ADDRESS + FIXED_PARTITION_OFFSET(KEY_TABLE_PARTITION));
+
+static uint32_t key_count;
+
+int key_table_init(void)
+{
+	const size_t max_keys = (FIXED_PARTITION_SIZE(KEY_TABLE_PARTITION) - KEY_TABLE_HEADER_SIZE) /
+				KEY_TABLE_KEY_SIZE;
+	uint32_t count;
+
+	/* key_count is written once per call, readers never see a passing 0 */
+	if (sys_get_le32(&key_table_base[0]) != KEY_TABLE_MAGIC ||
+	    sys_get_le16(&key_table_base[4]) != KEY_TABLE_VERSION ||
+	    sys_get_le16(&key_table_base[6]) != KEY_TABLE_KEY_SIZE) {
+		key_count = 0;
+		return -ENOENT;
+	}
+
+	count = sys_get_le32(&key_table_base[8]);
+	if (count == 0 || count > max_keys) {
+		LOG_ERR("Key table count %u invalid (max %u)", count, (unsigned int)max_keys);
+		key_count = 0;
+		return -EINVAL;
+	}
+
+	key_count = count;
+	return count;
+}
+
+uint32_t key_table_count(void)
+{
+	return key_count;
+}
+
+const uint8_t *key_table_get(uint32_t index)
+{
+	if (index >= key_count) {
+		return NULL;
+	}
+	return &key_table_base[KEY_TABLE_HEADER_SIZE + index * KEY_TABLE_KEY_SIZE];
+}
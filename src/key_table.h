@@ -0,0 +1,35 @@
+#ifndef KEY_TABLE_H
+#define KEY_TABLE_H
+
+#include <stdint.h>
+
+/*
+ * Flash-resident table of precomputed Apple FindMy public keys.
+ * Layout of the key_table_partition:
+ *   [0-3]:   Magic (KEY_TABLE_MAGIC, little-endian)
+ *   [4-5]:   Format version (KEY_TABLE_VERSION)
+ *   [6-7]:   Key size (KEY_TABLE_KEY_SIZE)
+ *   [8-11]:  Number of keys
+ *   [12-15]: Reserved (0xFF)
+ *   [16-]:   Keys, KEY_TABLE_KEY_SIZE bytes each, back to back
+ */
+#define KEY_TABLE_MAGIC 0x544b5448 /* "HTKT" */
+#define KEY_TABLE_VERSION 1
+#define KEY_TABLE_HEADER_SIZE 16
+
+/* 28-byte P-224 public keys, same as APPLE_KEY_SIZE */
+#define KEY_TABLE_KEY_SIZE 28
+
+/*
+ * Validate the table header, returns the number of keys or a negative error.
+ * Call from tag_work_q only, other threads read key_table_count().
+ */
+int key_table_init(void);
+
+/* Number of keys in a valid table, 0 if there is none */
+uint32_t key_table_count(void);
+
+/* Key at index, read straight from memory-mapped flash (no copy) */
+const uint8_t *key_table_get(uint32_t index);
+
+#endif /* KEY_TABLE_H */
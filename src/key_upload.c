@@ -0,0 +1,325 @@
+/* key_upload.c - Key table upload over an L2CAP connection-oriented channel */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/l2cap.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/logging/log.h>
+
+#include "key_table.h"
+#include "key_upload.h"
+#include "tag_work.h"
+
+LOG_MODULE_REGISTER(key_upload, CONFIG_TAG_LOG_LEVEL);
+
+#define KEY_TABLE_PARTITION key_table_partition
+#define UPLOAD_CHUNK_SIZE CONFIG_TAG_KEY_UPLOAD_CHUNK_SIZE
+#define UPLOAD_SDU_MTU (KEY_UPLOAD_DATA_HDR_SIZE + UPLOAD_CHUNK_SIZE)
+
+BUILD_ASSERT(FIXED_PARTITION_SIZE(KEY_TABLE_PARTITION) % UPLOAD_CHUNK_SIZE == 0,
+	     "Key table partition must be a whole number of upload chunks");
+
+/* One SDU in flight: credits for the next come back once it is in flash */
+NET_BUF_POOL_FIXED_DEFINE(upload_rx_pool, 1, BT_L2CAP_SDU_BUF_SIZE(UPLOAD_SDU_MTU), 8, NULL);
+NET_BUF_POOL_FIXED_DEFINE(upload_tx_pool, 2, BT_L2CAP_SDU_BUF_SIZE(KEY_UPLOAD_RSP_SIZE), 8, NULL);
+
+static K_FIFO_DEFINE(upload_rx_fifo);
+
+static const struct flash_area *upload_fa;
+static key_upload_handler_t upload_handler;
+
+/* Image being uploaded, upload_size is 0 when no upload is in progress */
+static uint32_t upload_size;
+static uint32_t upload_crc;
+static uint8_t upload_header[KEY_TABLE_HEADER_SIZE];
+static bool upload_header_received;
+
+static void upload_work_handler(struct k_work *work);
+
+K_WORK_DEFINE(upload_work, upload_work_handler);
+
+static struct net_buf *upload_alloc_buf(struct bt_l2cap_chan *chan)
+{
+	return net_buf_alloc(&upload_rx_pool, K_NO_WAIT);
+}
+
+/* Flash work is too slow for the RX thread, finish it on the workqueue */
+static int upload_recv(struct bt_l2cap_chan *chan, struct net_buf *buf)
+{
+	k_fifo_put(&upload_rx_fifo, buf);
+	k_work_submit_to_queue(&tag_work_q, &upload_work);
+	return -EINPROGRESS;
+}
+
+static void upload_connected(struct bt_l2cap_chan *chan)
+{
+	LOG_DBG("Key upload channel connected");
+}
+
+static void upload_disconnected(struct bt_l2cap_chan *chan)
+{
+	if (upload_size) {
+		LOG_WRN("Key upload aborted");
+		upload_size = 0;
+	}
+}
+
+static const struct bt_l2cap_chan_ops upload_chan_ops = {
+	.alloc_buf = upload_alloc_buf,
+	.recv = upload_recv,
+	.connected = upload_connected,
+	.disconnected = upload_disconnected,
+};
+
+static struct bt_l2cap_le_chan upload_chan = {
+	.chan.ops = &upload_chan_ops,
+	.rx.mtu = UPLOAD_SDU_MTU,
+};
+
+static int upload_accept(struct bt_conn *conn, struct bt_l2cap_server *server,
+			 struct bt_l2cap_chan **chan)
+{
+	if (upload_chan.chan.conn) {
+		return -ENOMEM;
+	}
+	*chan = &upload_chan.chan;
+	return 0;
+}
+
+static struct bt_l2cap_server upload_server = {
+	.psm = CONFIG_TAG_KEY_UPLOAD_PSM,
+	.sec_level = BT_SECURITY_L1,
+	.accept = upload_accept,
+};
+
+/* CRC32 of image bytes in flash, with the held-back header in place of its slot */
+static int readback_crc(uint32_t offset, uint32_t len, uint32_t *crc)
+{
+	uint8_t block[64];
+	uint32_t value = 0;
+	int err;
+
+	if (offset == 0) {
+		value = crc32_ieee(upload_header, KEY_TABLE_HEADER_SIZE);
+		offset = KEY_TABLE_HEADER_SIZE;
+		len -= KEY_TABLE_HEADER_SIZE;
+	}
+
+	while (len > 0) {
+		const uint32_t n = MIN(len, sizeof(block));
+
+		err = flash_area_read(upload_fa, offset, block, n);
+		if (err) {
+			return err;
+		}
+		value = crc32_ieee_update(value, block, n);
+		offset += n;
+		len -= n;
+	}
+
+	*crc = value;
+	return 0;
+}
+
+static int handle_start(const uint8_t *data, uint16_t len)
+{
+	const size_t max_size = FIXED_PARTITION_SIZE(KEY_TABLE_PARTITION);
+	uint32_t size;
+	int err;
+
+	if (len != 9) {
+		return -EINVAL;
+	}
+	size = sys_get_le32(&data[1]);
+	if (size < KEY_TABLE_HEADER_SIZE + KEY_TABLE_KEY_SIZE || size > max_size ||
+	    (size - KEY_TABLE_HEADER_SIZE) % KEY_TABLE_KEY_SIZE) {
+		return -EINVAL;
+	}
+
+	/* Drop the old table first so a partial upload is never used */
+	upload_handler(false);
+	err = flash_area_erase(upload_fa, 0, UPLOAD_CHUNK_SIZE);
+	if (err) {
+		return err;
+	}
+	key_table_init();
+
+	upload_size = size;
+	upload_crc = sys_get_le32(&data[5]);
+	upload_header_received = false;
+	LOG_INF("Key upload started: %u bytes", size);
+	return 0;
+}
+
+static int handle_data(const uint8_t *data, uint16_t len, uint32_t *offset)
+{
+	const uint8_t *chunk = &data[KEY_UPLOAD_DATA_HDR_SIZE];
+	uint32_t n;
+	uint32_t crc;
+	int err;
+
+	if (len <= KEY_UPLOAD_DATA_HDR_SIZE) {
+		return -EINVAL;
+	}
+	*offset = sys_get_le32(&data[1]);
+	n = len - KEY_UPLOAD_DATA_HDR_SIZE;
+
+	if (!upload_size) {
+		return -EPERM;
+	}
+	if (*offset % UPLOAD_CHUNK_SIZE || n > UPLOAD_CHUNK_SIZE ||
+	    *offset + n > upload_size || n % flash_area_align(upload_fa)) {
+		return -EINVAL;
+	}
+	if (*offset == 0 && n < KEY_TABLE_HEADER_SIZE) {
+		return -EINVAL;
+	}
+	if (crc32_ieee(chunk, n) != sys_get_le32(&data[5])) {
+		return -EBADMSG;
+	}
+
+	err = flash_area_erase(upload_fa, *offset, UPLOAD_CHUNK_SIZE);
+	if (err) {
+		return err;
+	}
+
+	if (*offset == 0) {
+		memcpy(upload_header, chunk, KEY_TABLE_HEADER_SIZE);
+		upload_header_received = true;
+		err = flash_area_write(upload_fa, KEY_TABLE_HEADER_SIZE,
+				       &chunk[KEY_TABLE_HEADER_SIZE], n - KEY_TABLE_HEADER_SIZE);
+	} else {
+		err = flash_area_write(upload_fa, *offset, chunk, n);
+	}
+	if (err) {
+		return err;
+	}
+
+	err = readback_crc(*offset, n, &crc);
+	if (err) {
+		return err;
+	}
+	return crc == sys_get_le32(&data[5]) ? 0 : -EIO;
+}
+
+static int handle_commit(uint32_t *count)
+{
+	uint32_t crc;
+	int err;
+
+	if (!upload_size || !upload_header_received) {
+		return -EPERM;
+	}
+
+	err = readback_crc(0, upload_size, &crc);
+	if (err) {
+		return err;
+	}
+	if (crc != upload_crc) {
+		LOG_WRN("Key upload CRC mismatch");
+		return -EBADMSG;
+	}
+	if (sys_get_le32(&upload_header[0]) != KEY_TABLE_MAGIC ||
+	    KEY_TABLE_HEADER_SIZE + sys_get_le32(&upload_header[8]) * KEY_TABLE_KEY_SIZE !=
+		    upload_size) {
+		return -EINVAL;
+	}
+
+	err = flash_area_write(upload_fa, 0, upload_header, KEY_TABLE_HEADER_SIZE);
+	if (err) {
+		return err;
+	}
+	upload_size = 0;
+
+	err = key_table_init();
+	if (err < 0) {
+		return err;
+	}
+	*count = err;
+	LOG_INF("Key upload complete: %u keys", *count);
+	upload_handler(true);
+	return 0;
+}
+
+static void send_rsp(uint8_t op, int status, uint32_t value)
+{
+	struct net_buf *buf = net_buf_alloc(&upload_tx_pool, K_SECONDS(1));
+	int err;
+
+	if (!buf) {
+		LOG_ERR("No buffer for key upload response");
+		return;
+	}
+	net_buf_reserve(buf, BT_L2CAP_SDU_CHAN_SEND_RESERVE);
+	net_buf_add_u8(buf, op | KEY_UPLOAD_OP_RSP);
+	net_buf_add_u8(buf, -status);
+	net_buf_add_le32(buf, value);
+
+	err = bt_l2cap_chan_send(&upload_chan.chan, buf);
+	if (err < 0) {
+		LOG_ERR("Failed to send key upload response (err %d)", err);
+		net_buf_unref(buf);
+	}
+}
+
+static void handle_request(const uint8_t *data, uint16_t len)
+{
+	uint32_t value = 0;
+	int err;
+
+	if (len == 0) {
+		return;
+	}
+
+	switch (data[0]) {
+	case KEY_UPLOAD_OP_START:
+		err = handle_start(data, len);
+		break;
+	case KEY_UPLOAD_OP_DATA:
+		err = handle_data(data, len, &value);
+		break;
+	case KEY_UPLOAD_OP_COMMIT:
+		err = handle_commit(&value);
+		break;
+	default:
+		err = -ENOTSUP;
+		break;
+	}
+
+	if (err) {
+		LOG_WRN("Key upload request 0x%02x failed (err %d)", data[0], err);
+	}
+	send_rsp(data[0], err, value);
+}
+
+static void upload_work_handler(struct k_work *work)
+{
+	struct net_buf *buf;
+
+	while ((buf = k_fifo_get(&upload_rx_fifo, K_NO_WAIT)) != NULL) {
+		handle_request(buf->data, buf->len);
+
+		/* Frees the buffer and hands the credits back to the sender */
+		bt_l2cap_chan_recv_complete(&upload_chan.chan, buf);
+	}
+}
+
+int key_upload_init(key_upload_handler_t handler)
+{
+	int err = flash_area_open(FIXED_PARTITION_ID(KEY_TABLE_PARTITION), &upload_fa);
+
+	if (err) {
+		return err;
+	}
+	upload_handler = handler;
+	return bt_l2cap_server_register(&upload_server);
+}
@@ -0,0 +1,45 @@
+#ifndef KEY_UPLOAD_H
+#define KEY_UPLOAD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Key table upload over an L2CAP connection-oriented channel on
+ * CONFIG_TAG_KEY_UPLOAD_PSM. Every SDU is one request, answered by one
+ * response SDU:
+ *
+ * Requests (little-endian):
+ *   START  [0] 0x01, [1-4] image size, [5-8] CRC32 of the image
+ *   DATA   [0] 0x02, [1-4] offset (chunk aligned), [5-8] CRC32 of the
+ *          data, [9-] up to CONFIG_TAG_KEY_UPLOAD_CHUNK_SIZE bytes
+ *   COMMIT [0] 0x03
+ *
+ * Response:
+ *   [0] request opcode | 0x80, [1] status (0 or errno), [2-5] offset
+ *   for DATA, key count for COMMIT
+ *
+ * Each chunk is erased, written and read back before its credits are
+ * returned, so the sender can never run ahead of flash. The table
+ * header is held back and written last on COMMIT, after the whole image
+ * CRC matches, so an interrupted upload leaves no valid table behind.
+ */
+#define KEY_UPLOAD_OP_START 0x01
+#define KEY_UPLOAD_OP_DATA 0x02
+#define KEY_UPLOAD_OP_COMMIT 0x03
+#define KEY_UPLOAD_OP_RSP 0x80
+
+#define KEY_UPLOAD_DATA_HDR_SIZE 9
+#define KEY_UPLOAD_RSP_SIZE 6
+
+/*
+ * Runs on tag_work_q when an upload changes the table: present is false
+ * just before START erases it and true once COMMIT has validated the new
+ * one, so the advertiser can stop using the old keys and pick up the new.
+ */
+typedef void (*key_upload_handler_t)(bool present);
+
+/* Register the L2CAP server, call once Bluetooth is enabled */
+int key_upload_init(key_upload_handler_t handler);
+
+#endif /* KEY_UPLOAD_H */
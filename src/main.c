@@ -12,283 +12,2062 @@
 
 #include <zephyr/bluetooth/bluetooth.h>
 #include <zephyr/bluetooth/hci.h>
-#include <zephyr/bluetooth/controller.h>
+#include <zephyr/bluetooth/hci_vs.h>
 #include <zephyr/bluetooth/conn.h>
 #include <zephyr/bluetooth/uuid.h>
 #include <zephyr/bluetooth/gatt.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/sys/poweroff.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/drivers/hwinfo.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/sys/byteorder.h>
+#if defined(CONFIG_TAG_PROV_WAKE_NFC)
+#include <hal/nrf_nfct.h>
+#endif
 
 #include "main.h"
+#include "tag_work.h"
+#include "key_table.h"
+#include "key_upload.h"
+#include "eid.h"
+#include "motion.h"
+#include "battery.h"
+#include "stats.h"
+#include "bench.h"
+#include "quiet.h"
+#include "retained.h"
+#include "adv_frames.h"
 
-static bool device_configured = false;
+LOG_MODULE_REGISTER(tag, CONFIG_TAG_LOG_LEVEL);
 
+K_THREAD_STACK_DEFINE(tag_work_q_stack, CONFIG_TAG_WORKQUEUE_STACK_SIZE);
+struct k_work_q tag_work_q;
+
+/* Lifecycle state, changed on tag_work_q only (see set_tag_state) */
+static tag_state_t tag_state = TAG_STATE_UNPROVISIONED;
+
+static const char *const tag_state_names[] = {
+	[TAG_STATE_UNPROVISIONED] = "unprovisioned",
+	[TAG_STATE_PROVISIONING] = "provisioning",
+	[TAG_STATE_BEACONING] = "beaconing",
+	[TAG_STATE_ROTATING] = "rotating",
+};
+
+BUILD_ASSERT(TAG_STAT_ROTATING_MS - TAG_STAT_UNPROVISIONED_MS == TAG_STATE_ROTATING,
+	     "State time counters must follow tag_state_t");
+
+/* Allowed transitions, one bit per target state */
+static const uint8_t tag_state_next[] = {
+	[TAG_STATE_UNPROVISIONED] = BIT(TAG_STATE_PROVISIONING) | BIT(TAG_STATE_BEACONING),
+	[TAG_STATE_PROVISIONING] = BIT(TAG_STATE_BEACONING),
+	[TAG_STATE_BEACONING] = BIT(TAG_STATE_ROTATING),
+	[TAG_STATE_ROTATING] = BIT(TAG_STATE_BEACONING),
+};
+
+/* The one place lifecycle transitions happen, each is logged with its uptime */
+static bool set_tag_state(tag_state_t state)
+{
+	if (!(tag_state_next[tag_state] & BIT(state))) {
+		LOG_ERR("Invalid state change %s -> %s", tag_state_names[tag_state],
+			tag_state_names[state]);
+		return false;
+	}
+	LOG_INF("State %s -> %s at %u ms", tag_state_names[tag_state], tag_state_names[state],
+		k_uptime_get_32());
+	stats_state_enter(state);
+#if defined(CONFIG_TAG_BENCH_MARKERS)
+	bench_mark_state(state);
+#endif
+	tag_state = state;
+	return true;
+}
+
+#if !defined(CONFIG_TAG_EXT_ADV)
 static protocol_t current_protocol = PROTOCOL_GOOGLE_FMDN;
 
-static uint8_t apple_key[28];
-static uint8_t google_key[20];
+/* Weighted time slicing: how long each protocol keeps the advertiser */
+static uint16_t protocol_slot_sec[] = {
+	[PROTOCOL_APPLE_FINDMY] = CONFIG_TAG_APPLE_SLOT_SEC,
+	[PROTOCOL_GOOGLE_FMDN] = CONFIG_TAG_GOOGLE_SLOT_SEC,
+};
+
+BUILD_ASSERT(CONFIG_TAG_APPLE_SLOT_SEC > 0 || CONFIG_TAG_GOOGLE_SLOT_SEC > 0,
+	     "At least one protocol needs a slot");
+
+#if defined(CONFIG_TAG_RETAINED_RESUME)
+/* Time the slot on air had left before a warm reset, 0 to switch right away */
+static uint32_t protocol_resume_ms;
+#endif
+#endif
+
+/* Beacon identity, created from the Apple key once provisioned */
+static uint8_t tag_id = BT_ID_DEFAULT;
+
+/* One complete set of provisioned keys */
+struct tag_keys {
+	uint8_t apple[APPLE_KEY_SIZE];
+	uint8_t google[GOOGLE_KEY_SIZE];
+#if defined(CONFIG_TAG_FMDN_EID)
+	/* Ephemeral identity key, replaces the static google EID when has_eik is set */
+	uint8_t eik[EIK_SIZE];
+	bool has_eik;
+#endif
+};
+
+/* Parts of key_staging received so far (bits in key_staged) */
+enum key_part {
+	KEY_PART_APPLE_1,
+	KEY_PART_APPLE_2,
+	KEY_PART_GOOGLE,
+	KEY_PART_EIK_1,
+	KEY_PART_EIK,
+	KEY_PART_QUIET, /* Quiet hours frame, not part of the key set */
+};
+
+/*
+ * Provisioning (GATT writes and scan frames on the BT RX thread, settings
+ * at boot) fills key_staging part by part. Once complete it is committed:
+ * copied into the idle bank, then keys_generation is bumped, which makes
+ * that bank (generation & 1) live. Readers copy the live bank with
+ * keys_snapshot() and retry if a commit raced with the copy, so neither
+ * side ever waits for the other.
+ */
+static struct tag_keys key_staging;
+static atomic_t key_staged;
+static struct tag_keys key_banks[2];
+static atomic_t keys_generation;
+
+/* Snapshot the beaconing path works from, only touched on tag_work_q */
+static struct tag_keys beacon_keys;
+
+/* Key the Apple payload and address are built from: beacon_keys or a key table slot */
+static const uint8_t *apple_key_active = beacon_keys.apple;
+
+#if defined(CONFIG_TAG_KEY_TABLE)
+BUILD_ASSERT(KEY_TABLE_KEY_SIZE == APPLE_KEY_SIZE);
+
+/* Current key table slot, persisted under "tag/rot" */
+static uint32_t key_index;
+
+/*
+ * Slots between "tag/rot" writes, about an hour of rotation, so NVS is not
+ * written every period. A warm reset takes the slot from the retained
+ * snapshot; a cold reset goes back at most this many slots.
+ */
+#define KEY_INDEX_STORE_SLOTS DIV_ROUND_UP(60, CONFIG_TAG_KEY_ROTATION_PERIOD_MIN)
+
+#if defined(CONFIG_TAG_RETAINED_RESUME)
+/* Time the key slot had left before a warm reset, 0 for a full period */
+static uint32_t key_rotation_resume_ms;
+#endif
+#endif
+
+#if defined(CONFIG_TAG_FMDN_EID)
+/* Beacon clock in seconds at boot, persisted under "tag/clk" */
+static uint32_t beacon_clock_base;
+
+static uint32_t beacon_clock(void)
+{
+	return beacon_clock_base + (uint32_t)(k_uptime_get() / MSEC_PER_SEC);
+}
+#endif
+
+/* Advertising interval (units of 0.625 ms) and TX power (dBm) per protocol */
+struct adv_timing {
+	uint16_t min;
+	uint16_t max;
+	int8_t tx_power;
+};
+
+struct adv_profile {
+	const char *name;
+	struct adv_timing apple;
+	struct adv_timing google;
+};
+
+static const struct adv_profile adv_profiles[ADV_PROFILE_COUNT] = {
+	[ADV_PROFILE_FAST] = {
+		.name = "fast",
+		.apple = { BT_GAP_ADV_FAST_INT_MIN_2, BT_GAP_ADV_FAST_INT_MAX_2, 0 },
+		.google = { BT_GAP_ADV_FAST_INT_MIN_2, BT_GAP_ADV_FAST_INT_MAX_2, 0 },
+	},
+	[ADV_PROFILE_BALANCED] = {
+		.name = "balanced",
+		.apple = { BT_GAP_MS_TO_ADV_INTERVAL(1000), BT_GAP_MS_TO_ADV_INTERVAL(1050), 0 },
+		.google = { BT_GAP_MS_TO_ADV_INTERVAL(1500), BT_GAP_MS_TO_ADV_INTERVAL(1550), -4 },
+	},
+	[ADV_PROFILE_LONGEVITY] = {
+		.name = "longevity",
+		.apple = { BT_GAP_MS_TO_ADV_INTERVAL(2000), BT_GAP_MS_TO_ADV_INTERVAL(2050), -8 },
+		.google = { BT_GAP_MS_TO_ADV_INTERVAL(2000), BT_GAP_MS_TO_ADV_INTERVAL(2050), -8 },
+	},
+};
+
+/* Selected interval profile, persisted under "tag/prof" */
+static uint8_t adv_profile = CONFIG_TAG_ADV_PROFILE_DEFAULT;
+
+#if defined(CONFIG_TAG_MOTION)
+/* Cleared by the accelerometer after CONFIG_TAG_MOTION_STATIONARY_SEC without motion */
+static bool tag_moving = true;
+#endif
+
+#if defined(CONFIG_TAG_QUIET_HOURS)
+/* Set for the daily quiet window, see quiet_changed() */
+static bool tag_quiet;
+#endif
+
+/* Profile the advertisers run with: the selected one, unless the tag is at rest */
+static const struct adv_profile *beacon_profile(void)
+{
+#if defined(CONFIG_TAG_QUIET_HOURS)
+	if (tag_quiet) {
+		return &adv_profiles[ADV_PROFILE_LONGEVITY];
+	}
+#endif
+#if defined(CONFIG_TAG_MOTION)
+	if (!tag_moving) {
+		return &adv_profiles[CONFIG_TAG_MOTION_STATIONARY_PROFILE];
+	}
+#endif
+	return &adv_profiles[adv_profile];
+}
+
+/* Whether a protocol goes on air now: quiet hours keep Apple FindMy at most */
+static bool protocol_on_air(protocol_t protocol)
+{
+#if defined(CONFIG_TAG_QUIET_HOURS)
+	if (tag_quiet) {
+		return IS_ENABLED(CONFIG_TAG_QUIET_APPLE_ONLY) && protocol == PROTOCOL_APPLE_FINDMY;
+	}
+#endif
+	return true;
+}
+
+/* Keys are persisted under "tag/" once when beaconing first starts */
+static bool keys_stored = false;
+
+/*
+ * Beacon state came back from retained RAM (CONFIG_TAG_RETAINED_RESUME),
+ * and so did payloads still valid for the current EID period.
+ */
+static bool resumed;
+static bool resumed_payloads;
+
+static void keys_snapshot(struct tag_keys *keys)
+{
+	atomic_val_t generation;
+
+	do {
+		generation = atomic_get(&keys_generation);
+		memcpy(keys, &key_banks[generation & 1], sizeof(*keys));
+	} while (atomic_get(&keys_generation) != generation);
+}
+
+static bool keys_staged_complete(void)
+{
+	const atomic_val_t parts = atomic_get(&key_staged);
+	const atomic_val_t apple = BIT(KEY_PART_APPLE_1) | BIT(KEY_PART_APPLE_2);
+
+	if ((parts & apple) != apple) {
+		return false;
+	}
+	/* Google is provisioned with either a static EID or an ephemeral identity key */
+	return parts & (BIT(KEY_PART_GOOGLE) | BIT(KEY_PART_EIK));
+}
+
+/* Publish key_staging once every part is in, staging starts over afterwards */
+static bool commit_keys(void)
+{
+	const atomic_val_t generation = atomic_get(&keys_generation);
+
+	if (!keys_staged_complete()) {
+		return false;
+	}
+#if defined(CONFIG_TAG_FMDN_EID)
+	key_staging.has_eik = atomic_test_bit(&key_staged, KEY_PART_EIK);
+#endif
+	memcpy(&key_banks[(generation + 1) & 1], &key_staging, sizeof(key_staging));
+	atomic_inc(&keys_generation);
+	atomic_clear(&key_staged);
+	return true;
+}
+
+#if !defined(CONFIG_TAG_BUILTIN_KEYS)
+/* A complete key set has been committed at least once */
+static bool keys_received(void)
+{
+	return atomic_get(&keys_generation) > 0;
+}
+#endif
+
+static void store_keys(void)
+{
+	int err = settings_save_one("tag/apple", beacon_keys.apple, sizeof(beacon_keys.apple));
+	if (!err) {
+		err = settings_save_one("tag/google", beacon_keys.google, sizeof(beacon_keys.google));
+	}
+#if defined(CONFIG_TAG_FMDN_EID)
+	if (!err && beacon_keys.has_eik) {
+		err = settings_save_one("tag/eik", beacon_keys.eik, sizeof(beacon_keys.eik));
+	}
+#endif
+	if (err) {
+		LOG_ERR("Failed to store keys (err %d)", err);
+		return;
+	}
+	keys_stored = true;
+	LOG_INF("Keys stored");
+}
+
+static int tag_settings_set(const char *name, size_t len, settings_read_cb read_cb, void *cb_arg)
+{
+	const char *next;
+	ssize_t rc;
+
+	if (settings_name_steq(name, "apple", &next) && !next) {
+		if (len != sizeof(key_staging.apple)) {
+			return -EINVAL;
+		}
+		rc = read_cb(cb_arg, key_staging.apple, sizeof(key_staging.apple));
+		if (rc < 0) {
+			return rc;
+		}
+		atomic_or(&key_staged, BIT(KEY_PART_APPLE_1) | BIT(KEY_PART_APPLE_2));
+		return 0;
+	}
+
+	if (settings_name_steq(name, "google", &next) && !next) {
+		if (len != sizeof(key_staging.google)) {
+			return -EINVAL;
+		}
+		rc = read_cb(cb_arg, key_staging.google, sizeof(key_staging.google));
+		if (rc < 0) {
+			return rc;
+		}
+		atomic_set_bit(&key_staged, KEY_PART_GOOGLE);
+		return 0;
+	}
+
+	if (settings_name_steq(name, "prof", &next) && !next) {
+		uint8_t profile;
+
+		if (len != sizeof(profile)) {
+			return -EINVAL;
+		}
+		rc = read_cb(cb_arg, &profile, sizeof(profile));
+		if (rc < 0) {
+			return rc;
+		}
+		if (profile < ADV_PROFILE_COUNT) {
+			adv_profile = profile;
+		}
+		return 0;
+	}
+
+#if defined(CONFIG_TAG_FMDN_EID)
+	if (settings_name_steq(name, "eik", &next) && !next) {
+		if (len != sizeof(key_staging.eik)) {
+			return -EINVAL;
+		}
+		rc = read_cb(cb_arg, key_staging.eik, sizeof(key_staging.eik));
+		if (rc < 0) {
+			return rc;
+		}
+		atomic_set_bit(&key_staged, KEY_PART_EIK);
+		return 0;
+	}
+
+	if (settings_name_steq(name, "clk", &next) && !next) {
+		if (len != sizeof(beacon_clock_base)) {
+			return -EINVAL;
+		}
+		rc = read_cb(cb_arg, &beacon_clock_base, sizeof(beacon_clock_base));
+		return rc < 0 ? rc : 0;
+	}
+#endif
+
+#if defined(CONFIG_TAG_QUIET_HOURS)
+	if (settings_name_steq(name, "quiet", &next) && !next) {
+		uint16_t window[2];
+
+		if (len != sizeof(window)) {
+			return -EINVAL;
+		}
+		rc = read_cb(cb_arg, window, sizeof(window));
+		if (rc < 0) {
+			return rc;
+		}
+		if (window[0] < QUIET_MINUTES_PER_DAY && window[1] < QUIET_MINUTES_PER_DAY) {
+			quiet_set_window(window[0], window[1]);
+		}
+		return 0;
+	}
+#endif
+
+#if defined(CONFIG_TAG_KEY_TABLE)
+	if (settings_name_steq(name, "rot", &next) && !next) {
+		if (len != sizeof(key_index)) {
+			return -EINVAL;
+		}
+		rc = read_cb(cb_arg, &key_index, sizeof(key_index));
+		return rc < 0 ? rc : 0;
+	}
+#endif
+
+	return -ENOENT;
+}
+
+static int tag_settings_commit(void)
+{
+	keys_stored = commit_keys();
+	return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(tag, "tag", NULL, tag_settings_set, tag_settings_commit, NULL);
+
+#if defined(CONFIG_TAG_KEY_TABLE)
+/* Use the key table slot when a table is present, the provisioned key otherwise */
+static void select_table_key(void)
+{
+	const uint32_t count = key_table_count();
+
+	if (count == 0) {
+		apple_key_active = beacon_keys.apple;
+		return;
+	}
+
+	key_index %= count;
+	apple_key_active = key_table_get(key_index);
+	LOG_INF("Key table: %d keys, slot %u", count, key_index);
+}
+
+/* Advance to the next key table slot */
+static void key_rotation_work_handler(struct k_work *work)
+{
+	struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+	const uint32_t count = key_table_count();
+	int err;
+
+	/* No valid table any more: back to the provisioned key, nothing to rotate */
+	if (count == 0) {
+		apple_key_active = beacon_keys.apple;
+		err = restart_apple_adv();
+		if (err) {
+			LOG_ERR("Failed to restore the provisioned Apple key (err %d)", err);
+		}
+		return;
+	}
+
+	set_tag_state(TAG_STATE_ROTATING);
+	key_index = (key_index + 1) % count;
+	apple_key_active = key_table_get(key_index);
+
+	err = restart_apple_adv();
+	if (err) {
+		LOG_ERR("Failed to rotate Apple key (err %d)", err);
+	} else {
+		LOG_INF("Rotated to key slot %u", key_index);
+	}
+
+	if (key_index % KEY_INDEX_STORE_SLOTS == 0) {
+		err = settings_save_one("tag/rot", &key_index, sizeof(key_index));
+		if (err) {
+			LOG_ERR("Failed to store key slot (err %d)", err);
+		}
+	}
+	set_tag_state(TAG_STATE_BEACONING);
+
+	k_work_schedule_for_queue(&tag_work_q, dwork, K_MINUTES(CONFIG_TAG_KEY_ROTATION_PERIOD_MIN));
+}
+
+K_WORK_DELAYABLE_DEFINE(key_rotation_work, key_rotation_work_handler);
+
+#if defined(CONFIG_TAG_KEY_UPLOAD)
+/* An upload is about to erase the table (present false) or has committed a new one */
+static void key_table_changed(bool present)
+{
+	int err;
+
+	k_work_cancel_delayable(&key_rotation_work);
+	if (present) {
+		key_index = 0;
+		select_table_key();
+		err = settings_save_one("tag/rot", &key_index, sizeof(key_index));
+		if (err) {
+			LOG_ERR("Failed to store key slot (err %d)", err);
+		}
+	} else {
+		apple_key_active = beacon_keys.apple;
+	}
+
+	/* Not beaconing yet: start_advertising_work picks the table up */
+	if (tag_state != TAG_STATE_BEACONING) {
+		return;
+	}
+
+	err = restart_apple_adv();
+	if (err) {
+		LOG_ERR("Failed to switch Apple key after upload (err %d)", err);
+	}
+	if (present && key_table_count() > 0) {
+		k_work_schedule_for_queue(&tag_work_q, &key_rotation_work,
+					  K_MINUTES(CONFIG_TAG_KEY_ROTATION_PERIOD_MIN));
+	}
+}
+#endif
+#endif /* CONFIG_TAG_KEY_TABLE */
+
+/* Work handler to start advertising after the key is received */
+static void start_advertising_work_handler(struct k_work *work)
+{
+	int err;
+
+	LOG_DBG("start advertising...");
+#if defined(CONFIG_TAG_PROV_SCAN)
+	err = stop_scan();
+	if (err && err != -EALREADY) {
+		LOG_ERR("Failed to stop scanning (err %d)", err);
+	}
+#endif
+#if !defined(CONFIG_TAG_BUILTIN_KEYS)
+	/* Stop the config or device ID advertisement, it runs on the default identity */
+	err = bt_le_adv_stop();
+	if (err) {
+		LOG_ERR("Failed to stop config advertising (err %d)", err);
+	}
+#endif
+	keys_snapshot(&beacon_keys);
+#if defined(CONFIG_TAG_KEY_TABLE)
+	select_table_key();
+#endif
+	err = set_mac_address();
+	if (err) {
+		LOG_ERR("Failed to set beacon address (err %d)", err);
+		return;
+	}
+	/* Payloads restored from retained RAM go on air as they are, once */
+	if (!resumed_payloads) {
+		prepare_adv_payloads();
+	}
+	resumed_payloads = false;
+	start_beaconing();
+	set_tag_state(TAG_STATE_BEACONING);
+
+#if defined(CONFIG_TAG_FMDN_EID)
+	if (beacon_keys.has_eik) {
+		start_eid_rotation();
+	}
+#endif
+
+	if (!keys_stored) {
+		store_keys();
+	}
+
+#if defined(CONFIG_TAG_KEY_TABLE)
+	if (key_table_count() > 0) {
+		k_timeout_t delay = K_MINUTES(CONFIG_TAG_KEY_ROTATION_PERIOD_MIN);
+
+#if defined(CONFIG_TAG_RETAINED_RESUME)
+		/* After a warm reset the key slot only gets what it had left */
+		if (key_rotation_resume_ms > 0) {
+			delay = K_MSEC(key_rotation_resume_ms);
+			key_rotation_resume_ms = 0;
+		}
+#endif
+		k_work_schedule_for_queue(&tag_work_q, &key_rotation_work, delay);
+	}
+#endif
+#if defined(CONFIG_TAG_RETAINED_RESUME)
+	start_resume_snapshots();
+#endif
+}
+
+K_WORK_DELAYABLE_DEFINE(start_advertising_work, start_advertising_work_handler);
+
+#if defined(CONFIG_TAG_BUILTIN_KEYS)
+/* Stage and commit the keys from the build configuration, they are never stored */
+static int load_builtin_keys(void)
+{
+	const char *const apple = CONFIG_TAG_BUILTIN_APPLE_KEY;
+	const char *const google = CONFIG_TAG_BUILTIN_GOOGLE_KEY;
+
+	if (hex2bin(apple, strlen(apple), key_staging.apple, APPLE_KEY_SIZE) != APPLE_KEY_SIZE) {
+		return -EINVAL;
+	}
+	atomic_or(&key_staged, BIT(KEY_PART_APPLE_1) | BIT(KEY_PART_APPLE_2));
+
+#if defined(CONFIG_TAG_FMDN_EID)
+	const char *const eik = CONFIG_TAG_BUILTIN_EIK;
+
+	if (strlen(eik) > 0) {
+		if (hex2bin(eik, strlen(eik), key_staging.eik, EIK_SIZE) != EIK_SIZE) {
+			return -EINVAL;
+		}
+		atomic_set_bit(&key_staged, KEY_PART_EIK);
+	} else
+#endif
+	{
+		if (hex2bin(google, strlen(google), key_staging.google, GOOGLE_KEY_SIZE) !=
+		    GOOGLE_KEY_SIZE) {
+			return -EINVAL;
+		}
+		atomic_set_bit(&key_staged, KEY_PART_GOOGLE);
+	}
+
+	keys_stored = true;
+	return commit_keys() ? 0 : -EINVAL;
+}
+#else
+#if defined(CONFIG_TAG_PROV_GATT)
+/* Connected provisioning client, NULL when provisioned over scan frames */
+static struct bt_conn *config_conn;
+#endif
+
+/* Commit the keys once all parts are staged and start advertising */
+static void check_keys_and_start(void)
+{
+	k_timeout_t delay = K_NO_WAIT;
+
+	if (!commit_keys()) {
+		return;
+	}
+	LOG_INF("All keys received, starting advertising...");
+#if defined(CONFIG_TAG_PROV_GATT)
+	/* A connected client reads the digest first, beaconing starts on disconnect */
+	if (config_conn) {
+		delay = K_SECONDS(PROV_VERIFY_TIMEOUT_SEC);
+	}
+#endif
+	k_work_schedule_for_queue(&tag_work_q, &start_advertising_work, delay);
+}
+#endif /* CONFIG_TAG_BUILTIN_KEYS */
+
+#if defined(CONFIG_TAG_QUIET_HOURS)
+/* Store the provisioned window, the time is only kept in RAM (thread context) */
+static void quiet_store_work_handler(struct k_work *work)
+{
+	uint16_t window[2];
+	int err;
+
+	quiet_get_window(&window[0], &window[1]);
+	err = settings_save_one("tag/quiet", window, sizeof(window));
+	if (err) {
+		LOG_ERR("Failed to store quiet hours (err %d)", err);
+	}
+}
+
+K_WORK_DEFINE(quiet_store_work, quiet_store_work_handler);
+
+/* Take a QUIET_HOURS_SIZE payload, false if the window is out of range */
+static bool set_quiet_hours(const uint8_t *data)
+{
+	const uint16_t start = sys_get_le16(&data[4]);
+	const uint16_t end = sys_get_le16(&data[6]);
+
+	if (start >= QUIET_MINUTES_PER_DAY || end >= QUIET_MINUTES_PER_DAY) {
+		return false;
+	}
+	quiet_set_time(sys_get_le32(&data[0]));
+	quiet_set_window(start, end);
+	k_work_submit_to_queue(&tag_work_q, &quiet_store_work);
+	return true;
+}
+#endif
+
+#if defined(CONFIG_TAG_PROV_GATT)
+static ssize_t write_apple_key(struct bt_conn *conn,
+					 const struct bt_gatt_attr *attr,
+					 const void *buf, uint16_t len, uint16_t offset,
+					 uint8_t flags)
+{
+	if (offset != 0) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+	}
+
+	if (len == APPLE_KEY_SIZE) {
+		/* Whole key in one write, the MTU allows it */
+		memcpy(key_staging.apple, buf, APPLE_KEY_SIZE);
+		atomic_or(&key_staged, BIT(KEY_PART_APPLE_1) | BIT(KEY_PART_APPLE_2));
+		LOG_DBG("Apple key received (%d bytes)", APPLE_KEY_SIZE);
+		check_keys_and_start();
+	} else if (len == 20) {
+		/* First chunk: 20 bytes at offset 0 */
+		memcpy(key_staging.apple, buf, 20);
+		atomic_set_bit(&key_staged, KEY_PART_APPLE_1);
+		LOG_DBG("Apple key part 1 received (20 bytes)");
+	} else if (len == 8 && atomic_test_bit(&key_staged, KEY_PART_APPLE_1)) {
+		/* Second chunk: 8 bytes at offset 20 */
+		memcpy(&key_staging.apple[20], buf, 8);
+		LOG_DBG("Apple key part 2 received (8 bytes)");
+		atomic_set_bit(&key_staged, KEY_PART_APPLE_2);
+		check_keys_and_start();
+	} else {
+		LOG_WRN("Unexpected write: %u bytes (part1_received=%d)", len,
+			atomic_test_bit(&key_staged, KEY_PART_APPLE_1));
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+	}
+	return len;
+}
+
+static ssize_t write_google_key(struct bt_conn *conn,
+					 const struct bt_gatt_attr *attr,
+					 const void *buf, uint16_t len, uint16_t offset,
+					 uint8_t flags)
+{
+	if (len == GOOGLE_KEY_SIZE) {
+		memcpy(key_staging.google, buf, GOOGLE_KEY_SIZE);
+		LOG_DBG("Google key received (20 bytes)");
+		atomic_set_bit(&key_staged, KEY_PART_GOOGLE);
+		check_keys_and_start();
+	} else {
+		LOG_WRN("Unexpected Google key write: %u bytes (expected %d)", len, GOOGLE_KEY_SIZE);
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+	}
+	return len;
+}
+
+#if defined(CONFIG_TAG_FMDN_EID)
+/* 32-byte key exceeds the default ATT MTU, accept it as a prepared (long) write */
+static ssize_t write_google_eik(struct bt_conn *conn,
+				const struct bt_gatt_attr *attr,
+				const void *buf, uint16_t len, uint16_t offset,
+				uint8_t flags)
+{
+	if (offset + len > EIK_SIZE) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+	}
+	if (flags & BT_GATT_WRITE_FLAG_PREPARE) {
+		return 0;
+	}
+
+	memcpy(&key_staging.eik[offset], buf, len);
+	if (offset + len == EIK_SIZE) {
+		LOG_DBG("Google identity key received (%d bytes)", EIK_SIZE);
+		atomic_set_bit(&key_staged, KEY_PART_EIK);
+		check_keys_and_start();
+	}
+	return len;
+}
+#endif
+#endif /* CONFIG_TAG_PROV_GATT */
+
+#if !defined(CONFIG_TAG_BUILTIN_KEYS)
+/* Store the new profile and move running advertisers to it (thread context) */
+static void adv_profile_work_handler(struct k_work *work)
+{
+	const int err = settings_save_one("tag/prof", &adv_profile, sizeof(adv_profile));
+
+	if (err) {
+		LOG_ERR("Failed to store advertising profile (err %d)", err);
+	}
+	apply_adv_profile();
+}
+
+K_WORK_DEFINE(adv_profile_work, adv_profile_work_handler);
+#endif
+
+#if defined(CONFIG_TAG_MOTION)
+/* Motion state changed (tag_work_q), the selected profile itself is kept */
+static void motion_changed(bool moving)
+{
+	tag_moving = moving;
+	LOG_INF("Tag %s, advertising profile: %s", moving ? "moving" : "stationary",
+		beacon_profile()->name);
+	apply_adv_profile();
+}
+#endif
+
+#if !defined(CONFIG_TAG_BUILTIN_KEYS)
+static void set_adv_profile(uint8_t profile)
+{
+	if (profile == adv_profile) {
+		return;
+	}
+	adv_profile = profile;
+	LOG_INF("Advertising profile: %s", adv_profiles[profile].name);
+	k_work_submit_to_queue(&tag_work_q, &adv_profile_work);
+}
+#endif
+
+#if defined(CONFIG_TAG_PROV_GATT)
+static ssize_t read_adv_profile(struct bt_conn *conn,
+				const struct bt_gatt_attr *attr,
+				void *buf, uint16_t len, uint16_t offset)
+{
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, &adv_profile, sizeof(adv_profile));
+}
+
+static ssize_t write_adv_profile(struct bt_conn *conn,
+				 const struct bt_gatt_attr *attr,
+				 const void *buf, uint16_t len, uint16_t offset,
+				 uint8_t flags)
+{
+	uint8_t profile;
+
+	if (offset != 0 || len != 1) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+	}
+	profile = *(const uint8_t *)buf;
+	if (profile >= ADV_PROFILE_COUNT) {
+		return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+	}
+	set_adv_profile(profile);
+	return len;
+}
+
+#if defined(CONFIG_TAG_FMDN_EID)
+BUILD_ASSERT(PROV_BLOB_EIK_SIZE == EIK_SIZE);
+#endif
+
+/* Reassembly buffer for the provisioning blob */
+static uint8_t prov_blob[PROV_BLOB_MAX_SIZE];
+
+static size_t prov_blob_size(uint8_t blob_flags)
+{
+	const size_t google_size = (blob_flags & PROV_BLOB_FLAG_EIK) ? PROV_BLOB_EIK_SIZE
+								    : GOOGLE_KEY_SIZE;
+
+	return PROV_BLOB_HEADER_SIZE + APPLE_KEY_SIZE + google_size + PROV_BLOB_CRC_SIZE;
+}
+
+/* Validate a complete blob and take its keys and profile */
+static int apply_prov_blob(size_t size)
+{
+	const uint8_t blob_flags = prov_blob[1];
+	const uint8_t profile = prov_blob[2];
+	const uint8_t *key = &prov_blob[PROV_BLOB_HEADER_SIZE];
+	const size_t crc_offset = size - PROV_BLOB_CRC_SIZE;
+
+	if (prov_blob[0] != PROV_BLOB_VERSION) {
+		LOG_WRN("Unsupported provisioning blob version %u", prov_blob[0]);
+		return BT_ATT_ERR_VALUE_NOT_ALLOWED;
+	}
+	if (crc32_ieee(prov_blob, crc_offset) != sys_get_le32(&prov_blob[crc_offset])) {
+		LOG_WRN("Provisioning blob CRC mismatch");
+		return BT_ATT_ERR_VALUE_NOT_ALLOWED;
+	}
+	if (profile >= ADV_PROFILE_COUNT && profile != PROV_BLOB_PROFILE_KEEP) {
+		return BT_ATT_ERR_VALUE_NOT_ALLOWED;
+	}
+#if !defined(CONFIG_TAG_FMDN_EID)
+	if (blob_flags & PROV_BLOB_FLAG_EIK) {
+		LOG_WRN("Identity key not supported by this build");
+		return BT_ATT_ERR_VALUE_NOT_ALLOWED;
+	}
+#endif
+
+	memcpy(key_staging.apple, key, APPLE_KEY_SIZE);
+	atomic_or(&key_staged, BIT(KEY_PART_APPLE_1) | BIT(KEY_PART_APPLE_2));
+	key += APPLE_KEY_SIZE;
+
+#if defined(CONFIG_TAG_FMDN_EID)
+	if (blob_flags & PROV_BLOB_FLAG_EIK) {
+		memcpy(key_staging.eik, key, EIK_SIZE);
+		atomic_set_bit(&key_staged, KEY_PART_EIK);
+	} else
+#endif
+	{
+		memcpy(key_staging.google, key, GOOGLE_KEY_SIZE);
+		atomic_set_bit(&key_staged, KEY_PART_GOOGLE);
+	}
+
+	LOG_INF("Provisioning blob received (%u bytes)", (unsigned int)size);
+	if (profile != PROV_BLOB_PROFILE_KEEP) {
+		set_adv_profile(profile);
+	}
+	check_keys_and_start();
+	return 0;
+}
+
+/*
+ * All keys and the profile in one write. The blob exceeds the default
+ * ATT MTU, so clients either negotiate a larger MTU or fall back to a
+ * prepared (long) write; both arrive here with increasing offsets.
+ */
+static ssize_t write_prov_blob(struct bt_conn *conn,
+			       const struct bt_gatt_attr *attr,
+			       const void *buf, uint16_t len, uint16_t offset,
+			       uint8_t flags)
+{
+	size_t size;
+	int err;
+
+	if (offset + len > PROV_BLOB_MAX_SIZE) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+	}
+	if (flags & BT_GATT_WRITE_FLAG_PREPARE) {
+		return 0;
+	}
+
+	memcpy(&prov_blob[offset], buf, len);
+	if (offset + len < PROV_BLOB_HEADER_SIZE) {
+		return len;
+	}
+
+	size = prov_blob_size(prov_blob[1]);
+	if (offset + len > size) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+	}
+	if (offset + len == size) {
+		err = apply_prov_blob(size);
+		if (err) {
+			return BT_GATT_ERR(err);
+		}
+	}
+	return len;
+}
+
+static ssize_t read_prov_digest(struct bt_conn *conn,
+				const struct bt_gatt_attr *attr,
+				void *buf, uint16_t len, uint16_t offset)
+{
+	uint8_t digest[PROV_DIGEST_SIZE] = { 0 };
+	struct tag_keys keys;
+	uint8_t digest_flags = keys_received() ? PROV_DIGEST_FLAG_COMPLETE : 0;
+	uint32_t crc;
+
+	/* Digest of the committed keys, i.e. what beaconing will use */
+	keys_snapshot(&keys);
+	crc = crc32_ieee(keys.apple, sizeof(keys.apple));
+#if defined(CONFIG_TAG_FMDN_EID)
+	if (keys.has_eik) {
+		crc = crc32_ieee_update(crc, keys.eik, sizeof(keys.eik));
+		digest_flags |= PROV_DIGEST_FLAG_EIK;
+	} else
+#endif
+	{
+		crc = crc32_ieee_update(crc, keys.google, sizeof(keys.google));
+	}
+
+	sys_put_le32(crc, &digest[0]);
+	digest[4] = adv_profile;
+	digest[5] = digest_flags;
+#if defined(CONFIG_TAG_KEY_TABLE)
+	sys_put_le32(key_table_count(), &digest[6]);
+#endif
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, digest, sizeof(digest));
+}
+
+static ssize_t read_stats(struct bt_conn *conn,
+			  const struct bt_gatt_attr *attr,
+			  void *buf, uint16_t len, uint16_t offset)
+{
+	uint32_t values[TAG_STAT_COUNT];
+	uint8_t data[TAG_STAT_COUNT * sizeof(uint32_t)];
+
+	stats_snapshot(values);
+	for (size_t i = 0; i < TAG_STAT_COUNT; i++) {
+		sys_put_le32(values[i], &data[i * sizeof(uint32_t)]);
+	}
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, data, sizeof(data));
+}
+
+#if defined(CONFIG_TAG_QUIET_HOURS)
+static ssize_t read_quiet_hours(struct bt_conn *conn,
+				const struct bt_gatt_attr *attr,
+				void *buf, uint16_t len, uint16_t offset)
+{
+	uint8_t data[QUIET_HOURS_SIZE];
+	uint16_t start;
+	uint16_t end;
+	uint32_t utc;
+
+	if (quiet_get_time(&utc)) {
+		utc = 0;
+	}
+	quiet_get_window(&start, &end);
+	sys_put_le32(utc, &data[0]);
+	sys_put_le16(start, &data[4]);
+	sys_put_le16(end, &data[6]);
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, data, sizeof(data));
+}
+
+static ssize_t write_quiet_hours(struct bt_conn *conn,
+				 const struct bt_gatt_attr *attr,
+				 const void *buf, uint16_t len, uint16_t offset,
+				 uint8_t flags)
+{
+	if (offset != 0 || len != QUIET_HOURS_SIZE) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+	}
+	if (!set_quiet_hours(buf)) {
+		return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+	}
+	return len;
+}
+#endif
+
+BT_GATT_SERVICE_DEFINE(config_svc,
+	BT_GATT_PRIMARY_SERVICE(&config_service_uuid),
+	BT_GATT_CHARACTERISTIC(&write_apple_key_cmd_uuid.uuid,
+				   BT_GATT_CHRC_WRITE,
+				   BT_GATT_PERM_WRITE, NULL,
+				   write_apple_key, key_staging.apple),
+	BT_GATT_CHARACTERISTIC(&write_google_key_cmd_uuid.uuid,
+				   BT_GATT_CHRC_WRITE,
+				   BT_GATT_PERM_WRITE, NULL,
+				   write_google_key, key_staging.google),
+	BT_GATT_CHARACTERISTIC(&adv_profile_uuid.uuid,
+				   BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE,
+				   BT_GATT_PERM_READ | BT_GATT_PERM_WRITE,
+				   read_adv_profile, write_adv_profile, &adv_profile),
+#if defined(CONFIG_TAG_FMDN_EID)
+	BT_GATT_CHARACTERISTIC(&write_google_eik_cmd_uuid.uuid,
+				   BT_GATT_CHRC_WRITE,
+				   BT_GATT_PERM_WRITE | BT_GATT_PERM_PREPARE_WRITE, NULL,
+				   write_google_eik, key_staging.eik),
+#endif
+	BT_GATT_CHARACTERISTIC(&write_prov_blob_cmd_uuid.uuid,
+				   BT_GATT_CHRC_WRITE,
+				   BT_GATT_PERM_WRITE | BT_GATT_PERM_PREPARE_WRITE, NULL,
+				   write_prov_blob, prov_blob),
+	BT_GATT_CHARACTERISTIC(&read_prov_digest_uuid.uuid,
+				   BT_GATT_CHRC_READ,
+				   BT_GATT_PERM_READ,
+				   read_prov_digest, NULL, NULL),
+	BT_GATT_CHARACTERISTIC(&read_stats_uuid.uuid,
+				   BT_GATT_CHRC_READ,
+				   BT_GATT_PERM_READ,
+				   read_stats, NULL, NULL),
+#if defined(CONFIG_TAG_QUIET_HOURS)
+	BT_GATT_CHARACTERISTIC(&quiet_hours_uuid.uuid,
+				   BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE,
+				   BT_GATT_PERM_READ | BT_GATT_PERM_WRITE,
+				   read_quiet_hours, write_quiet_hours, NULL),
+#endif
+);
+
+static const struct bt_data config_ad[] = {
+	BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
+	BT_DATA_BYTES(BT_DATA_UUID128_ALL, BT_UUID_CUSTOM_SERVICE_VAL),
+};
+#endif /* CONFIG_TAG_PROV_GATT */
+
+#if !defined(CONFIG_TAG_BUILTIN_KEYS)
+/*
+ * Device ID for addressed provisioning frames: the first DEVICE_ID_SIZE
+ * bytes of the hardware ID (FICR DEVICEID on nRF). Advertised in the
+ * config scan response, or without the config service in a
+ * non-connectable advertisement sent while scanning, as manufacturer
+ * data 0xFFE0:
+ *   [0-1]: Company ID (0xE0, 0xFF)
+ *   [2-5]: Device ID
+ */
+static uint8_t config_id_data[2 + DEVICE_ID_SIZE] = { 0xe0, 0xff };
+static uint8_t *const device_id = &config_id_data[2];
+
+#if defined(CONFIG_TAG_PROV_GATT)
+static const struct bt_data config_sd[] = {
+	BT_DATA(BT_DATA_NAME_COMPLETE, CONFIG_BT_DEVICE_NAME, sizeof(CONFIG_BT_DEVICE_NAME) - 1),
+	BT_DATA(BT_DATA_MANUFACTURER_DATA, config_id_data, sizeof(config_id_data)),
+};
+#elif defined(CONFIG_TAG_PROV_SCAN)
+static const struct bt_data id_ad[] = {
+	BT_DATA(BT_DATA_NAME_COMPLETE, CONFIG_BT_DEVICE_NAME, sizeof(CONFIG_BT_DEVICE_NAME) - 1),
+	BT_DATA(BT_DATA_MANUFACTURER_DATA, config_id_data, sizeof(config_id_data)),
+};
+
+/* Let stations find the device ID to address, next to the provisioning scan */
+static void start_id_advertising(void)
+{
+	const int err = bt_le_adv_start(BT_LE_ADV_PARAM(0, BT_GAP_ADV_SLOW_INT_MIN,
+							BT_GAP_ADV_SLOW_INT_MAX, NULL),
+					id_ad, ARRAY_SIZE(id_ad), NULL, 0);
+	if (err) {
+		LOG_ERR("Device ID advertising failed to start (err %d)", err);
+	}
+}
+#endif
+
+static void read_device_id(void)
+{
+	uint8_t hwid[8];
+	const ssize_t len = hwinfo_get_device_id(hwid, sizeof(hwid));
+
+	if (len < DEVICE_ID_SIZE) {
+		LOG_WRN("No hardware device ID (err %d)", (int)len);
+		return;
+	}
+	memcpy(device_id, hwid, DEVICE_ID_SIZE);
+	LOG_INF("Device ID %02x%02x%02x%02x", device_id[0], device_id[1], device_id[2], device_id[3]);
+}
+#endif /* !CONFIG_TAG_BUILTIN_KEYS */
+
+/* Frame layouts and their constant bytes are in adv_frames.h */
+BUILD_ASSERT(APPLE_FINDMY_KEY_OFFSET + SIZEOF_FIELD(struct apple_findmy_frame, key) ==
+	     APPLE_KEY_SIZE, "Apple frame must carry the key bytes not in the address");
+BUILD_ASSERT(SIZEOF_FIELD(struct google_fmdn_frame, eid) == GOOGLE_KEY_SIZE,
+	     "FMDN frame must carry a whole static EID");
+#if defined(CONFIG_TAG_FMDN_EID)
+BUILD_ASSERT(SIZEOF_FIELD(struct google_fmdn_frame, eid) == EID_SIZE,
+	     "FMDN frame must carry a whole EID");
+#endif
+
+static struct apple_findmy_frame apple_findmy_payload = APPLE_FINDMY_FRAME_INIT;
+
+static const struct bt_data apple_ad[] = {
+	BT_DATA(BT_DATA_MANUFACTURER_DATA, &apple_findmy_payload, APPLE_FINDMY_PAYLOAD_SIZE),
+};
+
+/* Double buffered: one payload is on air, the other takes the next EID */
+static struct google_fmdn_frame google_fmdn_payload[2] = {
+	GOOGLE_FMDN_FRAME_INIT,
+	GOOGLE_FMDN_FRAME_INIT,
+};
+static uint8_t google_payload_idx;
+
+static const struct bt_data google_ad[2][2] = {
+	{
+		BT_DATA_BYTES(BT_DATA_FLAGS, BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR),
+		BT_DATA(BT_DATA_SVC_DATA16, &google_fmdn_payload[0], GOOGLE_FMDN_PAYLOAD_SIZE),
+	},
+	{
+		BT_DATA_BYTES(BT_DATA_FLAGS, BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR),
+		BT_DATA(BT_DATA_SVC_DATA16, &google_fmdn_payload[1], GOOGLE_FMDN_PAYLOAD_SIZE),
+	},
+};
+
+/* Last battery bucket from the battery monitor, encoded by the payload builders */
+static enum battery_level battery_level = BATTERY_LEVEL_UNKNOWN;
+
+/* Apple status byte bits 6-7: full, medium, low, critically low */
+static uint8_t apple_battery_status(void)
+{
+	switch (battery_level) {
+	case BATTERY_LEVEL_MEDIUM:
+		return 0x40;
+	case BATTERY_LEVEL_LOW:
+		return 0x80;
+	case BATTERY_LEVEL_CRITICAL:
+		return 0xC0;
+	default:
+		return 0x00;
+	}
+}
+
+/* FMDN flags bits 5-6: not supported, normal, low, critically low */
+static uint8_t google_battery_flags(void)
+{
+	switch (battery_level) {
+	case BATTERY_LEVEL_FULL:
+	case BATTERY_LEVEL_MEDIUM:
+		return 1 << 5;
+	case BATTERY_LEVEL_LOW:
+		return 2 << 5;
+	case BATTERY_LEVEL_CRITICAL:
+		return 3 << 5;
+	default:
+		return 0x00;
+	}
+}
+
+/* Per-key fields of the Apple frame, written again on every key rotation */
+static void prepare_apple_findmy_adv(void)
+{
+	memcpy(apple_findmy_payload.key, &apple_key_active[APPLE_FINDMY_KEY_OFFSET],
+	       sizeof(apple_findmy_payload.key));
+	apple_findmy_payload.key_bits = (apple_key_active[0] >> 6) & 0x03;
+}
+
+/* Per-rotation field of an FMDN frame, the EID is all that changes */
+static void prepare_google_fmdn_adv(struct google_fmdn_frame *frame, const uint8_t *eid)
+{
+	memcpy(frame->eid, eid, sizeof(frame->eid));
+}
+
+/*
+ * Build both payloads once after provisioning. apple_ad and google_ad stay
+ * constant while beaconing, so a protocol switch only selects between them.
+ */
+static void prepare_adv_payloads(void)
+{
+	/* Battery fields, battery_changed() keeps them current from here on */
+	apple_findmy_payload.status = apple_battery_status();
+	google_fmdn_payload[0].flags = google_battery_flags();
+	google_fmdn_payload[1].flags = google_battery_flags();
+
+	prepare_apple_findmy_adv();
+
+#if defined(CONFIG_TAG_FMDN_EID)
+	if (beacon_keys.has_eik) {
+		uint8_t eid[EID_SIZE];
+		const int err = eid_compute(beacon_keys.eik, beacon_clock(), eid);
+
+		if (!err) {
+			prepare_google_fmdn_adv(&google_fmdn_payload[google_payload_idx], eid);
+			return;
+		}
+		LOG_ERR("EID computation failed (err %d), using static EID", err);
+		stats_inc(TAG_STAT_EID_FAILURES);
+	}
+#endif
+	prepare_google_fmdn_adv(&google_fmdn_payload[google_payload_idx], beacon_keys.google);
+}
+
+/*
+ * Set BLE MAC address based on protocol (following Everytag implementation).
+ * The address is installed as a static random identity next to the default
+ * one, so the stack keeps running and no controller reset is needed.
+ */
+static int set_mac_address(void)
+{
+	bt_addr_le_t addr = { .type = BT_ADDR_LE_RANDOM };
+	bt_addr_le_t ids[CONFIG_BT_ID_MAX];
+	size_t count = ARRAY_SIZE(ids);
+	int err;
+
+	/* For Apple: derive MAC from the first 6 bytes of a public key */
+	/* Address bytes are reversed */
+	addr.a.val[5] = apple_key_active[0] | 0xC0; /* MSB with static random bits */
+	addr.a.val[4] = apple_key_active[1];
+	addr.a.val[3] = apple_key_active[2];
+	addr.a.val[2] = apple_key_active[3];
+	addr.a.val[1] = apple_key_active[4];
+	addr.a.val[0] = apple_key_active[5]; /* LSB */
+
+	if (tag_id == BT_ID_DEFAULT) {
+		err = bt_id_create(&addr, NULL);
+		if (err < 0) {
+			return err;
+		}
+		tag_id = err;
+		return 0;
+	}
+
+	/* Identity already exists (re-provisioning), replace its address if it changed */
+	bt_id_get(ids, &count);
+	if (tag_id < count && bt_addr_le_cmp(&ids[tag_id], &addr) == 0) {
+		return 0;
+	}
+	err = bt_id_reset(tag_id, &addr, NULL);
+	return err < 0 ? err : 0;
+}
+
+/*
+ * Set the TX power of one advertising handle through the Zephyr vendor
+ * command. It takes effect from the next advertising event, so a running
+ * advertiser does not need to be restarted.
+ */
+static int set_adv_tx_power(uint8_t handle, int8_t tx_power)
+{
+	struct bt_hci_cp_vs_write_tx_power_level *cp;
+	struct bt_hci_rp_vs_write_tx_power_level *rp;
+	struct net_buf *buf;
+	struct net_buf *rsp = NULL;
+	int err;
+
+	if (!IS_ENABLED(CONFIG_TAG_TX_POWER)) {
+		return 0;
+	}
+
+	buf = bt_hci_cmd_create(BT_HCI_OP_VS_WRITE_TX_POWER_LEVEL, sizeof(*cp));
+	if (!buf) {
+		return -ENOBUFS;
+	}
+
+	cp = net_buf_add(buf, sizeof(*cp));
+	cp->handle_type = BT_HCI_VS_LL_HANDLE_TYPE_ADV;
+	cp->handle = sys_cpu_to_le16(handle);
+	cp->tx_power_level = tx_power;
+
+	err = bt_hci_cmd_send_sync(BT_HCI_OP_VS_WRITE_TX_POWER_LEVEL, buf, &rsp);
+	if (err) {
+		return err;
+	}
+
+	/* The controller rounds to the nearest level it supports */
+	rp = (void *)rsp->data;
+	LOG_DBG("Adv handle %u TX power %d dBm (requested %d)", handle,
+		rp->selected_tx_power, tx_power);
+	net_buf_unref(rsp);
+	return 0;
+}
+
+#if defined(CONFIG_TAG_EXT_ADV)
+/* One advertising set per protocol, both running all the time */
+static struct bt_le_ext_adv *apple_adv;
+static struct bt_le_ext_adv *google_adv;
+
+/* Create (once), load and, when on air, start an advertising set with legacy PDUs */
+static int start_adv_set(struct bt_le_ext_adv **adv, const struct bt_le_adv_param *param,
+			 const struct bt_data *ad, size_t ad_len, bool on_air)
+{
+	int err;
+
+	if (*adv == NULL) {
+		err = bt_le_ext_adv_create(param, NULL, adv);
+		if (err) {
+			return err;
+		}
+	}
+
+	err = bt_le_ext_adv_set_data(*adv, ad, ad_len, NULL, 0);
+	if (err || !on_air) {
+		return err;
+	}
+
+	/* A running set picks up the new data in place */
+	err = bt_le_ext_adv_start(*adv, BT_LE_EXT_ADV_START_DEFAULT);
+	return err == -EALREADY ? 0 : err;
+}
+
+static int set_adv_set_tx_power(struct bt_le_ext_adv *adv, int8_t tx_power)
+{
+	uint8_t handle;
+	int err;
+
+	if (adv == NULL) {
+		return 0;
+	}
+
+	err = bt_hci_get_adv_handle(adv, &handle);
+	if (err) {
+		return err;
+	}
+
+	return set_adv_tx_power(handle, tx_power);
+}
+
+/* Apple uses the key-derived identity address */
+static void apple_adv_param(struct bt_le_adv_param *param)
+{
+	*param = (struct bt_le_adv_param) {
+		.id = tag_id,
+		.options = BT_LE_ADV_OPT_USE_IDENTITY,
+		.interval_min = beacon_profile()->apple.min,
+		.interval_max = beacon_profile()->apple.max,
+	};
+}
+
+/* Google stays on the default identity and gets its own NRPA */
+static void google_adv_param(struct bt_le_adv_param *param)
+{
+	*param = (struct bt_le_adv_param) {
+		.id = BT_ID_DEFAULT,
+		.options = BT_LE_ADV_OPT_NONE,
+		.interval_min = beacon_profile()->google.min,
+		.interval_max = beacon_profile()->google.max,
+	};
+}
+
+/* Each set keeps its own power, so both protocols share the air at their own level */
+static void apply_adv_tx_power(void)
+{
+	int err;
+
+	err = set_adv_set_tx_power(apple_adv, beacon_profile()->apple.tx_power);
+	if (err) {
+		LOG_WRN("Failed to set Apple FindMy TX power (err %d)", err);
+	}
+
+	err = set_adv_set_tx_power(google_adv, beacon_profile()->google.tx_power);
+	if (err) {
+		LOG_WRN("Failed to set Google FMDN TX power (err %d)", err);
+	}
+}
+
+/* Start both protocol advertising sets */
+static void start_beaconing(void)
+{
+	const bool apple_on_air = protocol_on_air(PROTOCOL_APPLE_FINDMY);
+	const bool google_on_air = protocol_on_air(PROTOCOL_GOOGLE_FMDN);
+	struct bt_le_adv_param apple_param;
+	struct bt_le_adv_param google_param;
+	int err;
+
+	/* Both sets are created even off air, quiet hours only stop and start them */
+	apple_adv_param(&apple_param);
+	google_adv_param(&google_param);
+	err = start_adv_set(&apple_adv, &apple_param, apple_ad, ARRAY_SIZE(apple_ad), apple_on_air);
+	if (err) {
+		LOG_ERR("Failed to start Apple FindMy advertising set (err %d)", err);
+		stats_inc(TAG_STAT_ADV_ERRORS);
+	} else if (apple_on_air) {
+		stats_adv_start(TAG_STAT_ADV_EVENTS_APPLE, apple_param.interval_min, apple_ad,
+				ARRAY_SIZE(apple_ad));
+	}
+
+	err = start_adv_set(&google_adv, &google_param, google_ad[google_payload_idx],
+			    ARRAY_SIZE(google_ad[0]), google_on_air);
+	if (err) {
+		LOG_ERR("Failed to start Google FMDN advertising set (err %d)", err);
+		stats_inc(TAG_STAT_ADV_ERRORS);
+	} else if (google_on_air) {
+		stats_adv_start(TAG_STAT_ADV_EVENTS_GOOGLE, google_param.interval_min, google_ad[0],
+				ARRAY_SIZE(google_ad[0]));
+	}
+
+	apply_adv_tx_power();
+
+	LOG_INF("Advertising Apple FindMy and Google FMDN simultaneously (%s)",
+		beacon_profile()->name);
+}
+
+#if !defined(CONFIG_TAG_BUILTIN_KEYS) || defined(CONFIG_TAG_MOTION)
+/* Intervals can only change while a set is stopped, it stays stopped when off air */
+static int update_adv_set_param(struct bt_le_ext_adv *adv, const struct bt_le_adv_param *param,
+				bool on_air)
+{
+	int err;
+
+	if (adv == NULL) {
+		return 0;
+	}
+
+	err = bt_le_ext_adv_stop(adv);
+	if (err) {
+		return err;
+	}
+
+	err = bt_le_ext_adv_update_param(adv, param);
+	if (err || !on_air) {
+		return err;
+	}
+
+	return bt_le_ext_adv_start(adv, BT_LE_EXT_ADV_START_DEFAULT);
+}
+
+static void apply_adv_profile(void)
+{
+	const bool apple_on_air = protocol_on_air(PROTOCOL_APPLE_FINDMY);
+	const bool google_on_air = protocol_on_air(PROTOCOL_GOOGLE_FMDN);
+	struct bt_le_adv_param param;
+	int err;
+
+	apple_adv_param(&param);
+	err = update_adv_set_param(apple_adv, &param, apple_on_air);
+	if (err) {
+		LOG_ERR("Failed to update Apple FindMy interval (err %d)", err);
+		stats_inc(TAG_STAT_ADV_ERRORS);
+	} else if (apple_adv && apple_on_air) {
+		stats_adv_start(TAG_STAT_ADV_EVENTS_APPLE, param.interval_min, apple_ad,
+				ARRAY_SIZE(apple_ad));
+	} else {
+		stats_adv_stop(TAG_STAT_ADV_EVENTS_APPLE);
+	}
+
+	google_adv_param(&param);
+	err = update_adv_set_param(google_adv, &param, google_on_air);
+	if (err) {
+		LOG_ERR("Failed to update Google FMDN interval (err %d)", err);
+		stats_inc(TAG_STAT_ADV_ERRORS);
+	} else if (google_adv && google_on_air) {
+		stats_adv_start(TAG_STAT_ADV_EVENTS_GOOGLE, param.interval_min, google_ad[0],
+				ARRAY_SIZE(google_ad[0]));
+	} else {
+		stats_adv_stop(TAG_STAT_ADV_EVENTS_GOOGLE);
+	}
+
+	apply_adv_tx_power();
+}
+#endif
+
+#if defined(CONFIG_TAG_QUIET_HOURS)
+/* Sets off air are stopped in place, their data and rotation carry on */
+static void apply_quiet_hours(void)
+{
+	apply_adv_profile();
+}
+#endif
+
+#if defined(CONFIG_TAG_BATTERY)
+/* Reload both running sets after a payload byte changed in place */
+static int refresh_adv_payloads(void)
+{
+	int err;
+
+	if (apple_adv == NULL || google_adv == NULL) {
+		return 0;
+	}
+
+	err = bt_le_ext_adv_set_data(apple_adv, apple_ad, ARRAY_SIZE(apple_ad), NULL, 0);
+	if (err) {
+		return err;
+	}
+	return bt_le_ext_adv_set_data(google_adv, google_ad[google_payload_idx],
+				      ARRAY_SIZE(google_ad[0]), NULL, 0);
+}
+#endif
+
+#if defined(CONFIG_TAG_FMDN_EID)
+/* Load the current Google payload buffer into the running set */
+static int refresh_google_adv(void)
+{
+	if (google_adv == NULL) {
+		return -EAGAIN;
+	}
+	return bt_le_ext_adv_set_data(google_adv, google_ad[google_payload_idx],
+				      ARRAY_SIZE(google_ad[0]), NULL, 0);
+}
+#endif
+
+#if defined(CONFIG_TAG_KEY_TABLE)
+/* Move the Apple set to the current key, the Google set keeps running */
+static int restart_apple_adv(void)
+{
+	struct bt_le_adv_param apple_param;
+	int err;
+
+	if (apple_adv == NULL) {
+		return -EAGAIN;
+	}
+
+	err = bt_le_ext_adv_stop(apple_adv);
+	if (err) {
+		return err;
+	}
+
+	err = set_mac_address();
+	if (err) {
+		return err;
+	}
+
+	/* Re-applying the parameters loads the new identity address into the set */
+	apple_adv_param(&apple_param);
+	err = bt_le_ext_adv_update_param(apple_adv, &apple_param);
+	if (err) {
+		return err;
+	}
+
+	prepare_apple_findmy_adv();
+	return start_adv_set(&apple_adv, &apple_param, apple_ad, ARRAY_SIZE(apple_ad),
+			     protocol_on_air(PROTOCOL_APPLE_FINDMY));
+}
+#endif
+#else
+/*
+ * Without BT_EXT_ADV legacy advertising runs on the controller's first
+ * advertising handle. With it the host allocates the handle and
+ * CONFIG_TAG_TX_POWER is off, see its help.
+ */
+#define LEGACY_ADV_HANDLE 0
+
+/* Parameters and TX power the single advertiser is currently running with */
+static struct bt_le_adv_param beacon_param;
+static int8_t beacon_tx_power;
+static bool beacon_adv_running = false;
+
+#if defined(CONFIG_TAG_QUIET_HOURS)
+/* What was left of the protocol slot when the quiet hours began (or at a warm reset) */
+static k_ticks_t protocol_slot_left;
+#endif
+
+/* The single advertiser now sends this protocol only */
+static void adv_slot_started(protocol_t protocol, const struct adv_timing *timing,
+			     const struct bt_data *ad, size_t ad_len)
+{
+	if (protocol == PROTOCOL_APPLE_FINDMY) {
+		stats_adv_stop(TAG_STAT_ADV_EVENTS_GOOGLE);
+		stats_adv_start(TAG_STAT_ADV_EVENTS_APPLE, timing->min, ad, ad_len);
+	} else {
+		stats_adv_stop(TAG_STAT_ADV_EVENTS_APPLE);
+		stats_adv_start(TAG_STAT_ADV_EVENTS_GOOGLE, timing->min, ad, ad_len);
+	}
+#if defined(CONFIG_TAG_BENCH_MARKERS)
+	bench_mark_protocol(protocol);
+#endif
+}
+
+/*
+ * Start advertising for the current protocol. While the advertiser is
+ * running with matching parameters only the payload is swapped, so the
+ * switch leaves no gap on air. Profiles with different intervals per
+ * protocol restart it instead, which keeps each protocol at its own
+ * interval: the new protocol then goes out at most one outgoing interval
+ * plus the restart after the last frame of the old one, the bound the
+ * schedule suite checks on air.
+ */
+static int start_advertising(void)
+{
+	struct bt_le_adv_param adv_param = {
+		.id = tag_id,
+		.options = BT_LE_ADV_OPT_USE_IDENTITY,
+	};
+	protocol_t protocol = current_protocol;
+	const struct adv_timing *timing;
+	const struct bt_data *ad;
+	size_t ad_len;
+	int err;
+
+#if defined(CONFIG_TAG_QUIET_HOURS)
+	/* The slot schedule is held, only Apple FindMy may stay on air */
+	if (tag_quiet) {
+		protocol = PROTOCOL_APPLE_FINDMY;
+	}
+#endif
+	if (!protocol_on_air(protocol)) {
+		return 0;
+	}
+
+	if (protocol == PROTOCOL_APPLE_FINDMY) {
+		timing = &beacon_profile()->apple;
+		ad = apple_ad;
+		ad_len = ARRAY_SIZE(apple_ad);
+	} else {
+		timing = &beacon_profile()->google;
+		ad = google_ad[google_payload_idx];
+		ad_len = ARRAY_SIZE(google_ad[0]);
+	}
+	adv_param.interval_min = timing->min;
+	adv_param.interval_max = timing->max;
+
+	if (beacon_adv_running &&
+	    adv_param.id == beacon_param.id &&
+	    adv_param.interval_min == beacon_param.interval_min &&
+	    adv_param.interval_max == beacon_param.interval_max) {
+		/* Power goes with the slot, changed in place like the payload */
+		if (timing->tx_power != beacon_tx_power) {
+			err = set_adv_tx_power(LEGACY_ADV_HANDLE, timing->tx_power);
+			if (err) {
+				LOG_WRN("Failed to set TX power (err %d)", err);
+			}
+			beacon_tx_power = timing->tx_power;
+		}
+
+		err = bt_le_adv_update_data(ad, ad_len, NULL, 0);
+		if (!err) {
+			adv_slot_started(protocol, timing, ad, ad_len);
+		}
+		if (err != -EAGAIN) {
+			return err;
+		}
+		/* Advertiser was stopped behind our back, start it again */
+	}
+
+	/* First start, or the new protocol needs different parameters */
+	bt_le_adv_stop();
+	err = bt_le_adv_start(&adv_param, ad, ad_len, NULL, 0);
+	beacon_adv_running = (err == 0);
+	if (err) {
+		stats_adv_stop(TAG_STAT_ADV_EVENTS_APPLE);
+		stats_adv_stop(TAG_STAT_ADV_EVENTS_GOOGLE);
+		return err;
+	}
+	beacon_param = adv_param;
+
+	/* The controller only knows the legacy handle once it is advertising */
+	err = set_adv_tx_power(LEGACY_ADV_HANDLE, timing->tx_power);
+	if (err) {
+		LOG_WRN("Failed to set TX power (err %d)", err);
+	}
+	beacon_tx_power = timing->tx_power;
+
+	adv_slot_started(protocol, timing, ad, ad_len);
+	return 0;
+}
+
+/* Protocol switching, re-arms itself for the length of the slot just started */
+static void protocol_switch_work_handler(struct k_work *work)
+{
+	struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+	const protocol_t next = (current_protocol == PROTOCOL_APPLE_FINDMY) ?
+				PROTOCOL_GOOGLE_FMDN : PROTOCOL_APPLE_FINDMY;
+
+	/* A protocol with an empty slot is skipped, the current one keeps going */
+	if (protocol_slot_sec[next] > 0 || !beacon_adv_running) {
+		if (protocol_slot_sec[next] > 0) {
+			current_protocol = next;
+			stats_inc(TAG_STAT_PROTOCOL_SWITCHES);
+		}
+		LOG_DBG("Switching to %s for %u s",
+			current_protocol == PROTOCOL_APPLE_FINDMY ? "Apple FindMy" : "Google FMDN",
+			protocol_slot_sec[current_protocol]);
+
+		/* Swap in the payload of the new protocol */
+		const int err = start_advertising();
+		if (err) {
+			LOG_ERR("Failed to switch advertising (err %d)", err);
+			stats_inc(TAG_STAT_ADV_ERRORS);
+		}
+	}
 
-static bool apple_key_part1_received = false;
-static bool apple_key_part2_received = false;
-static bool google_key_received = false;
+	k_work_schedule_for_queue(&tag_work_q, dwork,
+				  K_SECONDS(MAX(protocol_slot_sec[current_protocol], 1)));
+}
 
-/* Work handler to start advertising after the key is received */
-static void start_advertising_work_handler(struct k_work *work)
+K_WORK_DELAYABLE_DEFINE(protocol_switch_work, protocol_switch_work_handler);
+
+#if defined(CONFIG_TAG_KEY_TABLE)
+/* Move the advertiser to the current key, keeping the current protocol */
+static int restart_apple_adv(void)
 {
-	printk("start advertising...\n");
-	int err = bt_le_scan_stop();
-	if (err) {
-		printk("Failed to stop scanning (err %d)\n", err);
-	}
-	err = bt_disable();
+	int err;
+
+	bt_le_adv_stop();
+	beacon_adv_running = false;
+
+	err = set_mac_address();
 	if (err) {
-		printk("Failed to disable Bluetooth (err %d)\n", err);
+		return err;
 	}
-	set_mac_address();
-	bt_enable(NULL);
-	k_timer_start(&protocol_timer, K_SECONDS(0), K_SECONDS(PROTOCOL_SWITCH_INTERVAL_SEC));
-}
 
-K_WORK_DELAYABLE_DEFINE(start_advertising_work, start_advertising_work_handler);
+	prepare_apple_findmy_adv();
+	return start_advertising();
+}
+#endif
 
-static bool keys_received() {
-	return apple_key_part1_received && apple_key_part2_received && google_key_received;
+#if defined(CONFIG_TAG_BATTERY)
+/* The payload on air is reloaded now, the other one goes out with the next switch */
+static int refresh_adv_payloads(void)
+{
+	if (!beacon_adv_running) {
+		return 0;
+	}
+	return start_advertising();
 }
-/* Check if both keys are received and start advertising */
-static void check_keys_and_start(void)
+#endif
+
+#if defined(CONFIG_TAG_FMDN_EID)
+/* Load the current Google payload buffer, or leave it for the next switch */
+static int refresh_google_adv(void)
 {
-	if (keys_received()) {
-		printk("All keys received, starting advertising in 2 seconds...\n");
-		device_configured = true;
-		k_work_schedule(&start_advertising_work, K_SECONDS(2));
+	if (current_protocol != PROTOCOL_GOOGLE_FMDN) {
+		return 0;
 	}
+	return start_advertising();
 }
+#endif
 
-static ssize_t write_apple_key(struct bt_conn *conn,
-					 const struct bt_gatt_attr *attr,
-					 const void *buf, uint16_t len, uint16_t offset,
-					 uint8_t flags)
+#if !defined(CONFIG_TAG_BUILTIN_KEYS) || defined(CONFIG_TAG_MOTION)
+/* The next start_advertising picks up the new intervals, apply them now */
+static void apply_adv_profile(void)
 {
-	if (len == 20) {
-		/* First chunk: 20 bytes at offset 0 */
-		memcpy(apple_key, buf, 20);
-		apple_key_part1_received = true;
-		printk("Apple key part 1 received (20 bytes)\n");
-	} else if (len == 8 && apple_key_part1_received) {
-		/* Second chunk: 8 bytes at offset 20 */
-		memcpy(&apple_key[20], buf, 8);
-		printk("Apple key part 2 received (8 bytes)\n");
-		printk("Complete apple key: ");
-		for (int i = 0; i < 28; i++) {
-			printk("%02x ", apple_key[i]);
-		}
-		printk("\n");
-		apple_key_part2_received = true;
-		check_keys_and_start();
-	} else {
-		printk("Unexpected write: %u bytes (part1_received=%d)\n", len, apple_key_part1_received);
+	if (!beacon_adv_running) {
+		return;
+	}
+
+	const int err = start_advertising();
+	if (err) {
+		LOG_ERR("Failed to update advertising interval (err %d)", err);
 	}
-	return len;
 }
+#endif
 
-static ssize_t write_google_key(struct bt_conn *conn,
-					 const struct bt_gatt_attr *attr,
-					 const void *buf, uint16_t len, uint16_t offset,
-					 uint8_t flags)
+/* Time-slice a single advertiser between protocols with protocol_switch_work */
+static void start_beaconing(void)
 {
-	if (len == GOOGLE_KEY_SIZE) {
-		memcpy(google_key, buf, GOOGLE_KEY_SIZE);
-		printk("Google key received (20 bytes): ");
-		for (int i = 0; i < GOOGLE_KEY_SIZE; i++) {
-			printk("%02x ", google_key[i]);
+	uint32_t slot_ms = 0;
+	int err;
+
+#if defined(CONFIG_TAG_RETAINED_RESUME)
+	/* After a warm reset the slot on air before goes on with what it had left */
+	slot_ms = protocol_resume_ms;
+	protocol_resume_ms = 0;
+#endif
+#if defined(CONFIG_TAG_QUIET_HOURS)
+	if (tag_quiet) {
+		/* The slot starts, or goes on, when the quiet hours end */
+		protocol_slot_left = k_ms_to_ticks_ceil64(slot_ms);
+		err = start_advertising();
+		if (err) {
+			LOG_ERR("Failed to start advertising (err %d)", err);
 		}
-		printk("\n");
-		google_key_received = true;
-		check_keys_and_start();
-	} else {
-		printk("Unexpected Google key write: %u bytes (expected %d)\n", len, GOOGLE_KEY_SIZE);
+		LOG_INF("Protocol switcher held until the quiet hours end");
+		return;
 	}
-	return len;
+#endif
+	if (slot_ms > 0) {
+		err = start_advertising();
+		if (err) {
+			LOG_ERR("Failed to start advertising (err %d)", err);
+		}
+	}
+	k_work_reschedule_for_queue(&tag_work_q, &protocol_switch_work, K_MSEC(slot_ms));
+	LOG_INF("Protocol switcher started (Apple %u s / Google %u s)",
+		protocol_slot_sec[PROTOCOL_APPLE_FINDMY], protocol_slot_sec[PROTOCOL_GOOGLE_FMDN]);
 }
 
-BT_GATT_SERVICE_DEFINE(config_svc,
-	BT_GATT_PRIMARY_SERVICE(&config_service_uuid),
-	BT_GATT_CHARACTERISTIC(&write_apple_key_cmd_uuid.uuid,
-				   BT_GATT_CHRC_WRITE,
-				   BT_GATT_PERM_WRITE, NULL,
-				   write_apple_key, &apple_key),
-	BT_GATT_CHARACTERISTIC(&write_google_key_cmd_uuid.uuid,
-				   BT_GATT_CHRC_WRITE,
-				   BT_GATT_PERM_WRITE, NULL,
-				   write_google_key, &google_key),
-);
+#if defined(CONFIG_TAG_QUIET_HOURS)
+/* Freeze the protocol slot in progress for the quiet hours, resume it afterwards */
+static void apply_quiet_hours(void)
+{
+	int err;
 
-static const struct bt_data config_ad[] = {
-	BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
-	BT_DATA_BYTES(BT_DATA_UUID128_ALL, BT_UUID_CUSTOM_SERVICE_VAL),
-};
+	if (tag_quiet) {
+		protocol_slot_left = k_work_delayable_remaining_get(&protocol_switch_work);
+		k_work_cancel_delayable(&protocol_switch_work);
+		bt_le_adv_stop();
+		beacon_adv_running = false;
+		stats_adv_stop(TAG_STAT_ADV_EVENTS_APPLE);
+		stats_adv_stop(TAG_STAT_ADV_EVENTS_GOOGLE);
+	} else {
+		k_work_schedule_for_queue(&tag_work_q, &protocol_switch_work,
+					  K_TICKS(protocol_slot_left));
+	}
 
-static const struct bt_data config_sd[] = {
-	BT_DATA(BT_DATA_NAME_COMPLETE, CONFIG_BT_DEVICE_NAME, sizeof(CONFIG_BT_DEVICE_NAME) - 1),
-};
-/*
- * Apple FindMy Offline Finding Advertisement Format:
- * - Uses manufacturer-specific data (Apple Company ID: 0x004C)
- * - Payload structure:
- *   [0-1]:  Apple Company ID (0x4C, 0x00) - 2 bytes
- *   [2]:    Type (0x12 for Offline Finding) - 1 byte
- *   [3]:    Length (0x19 = 25 bytes following) - 1 byte
- *   [4]:    Status byte (battery, motion, etc.) - 1 byte
- *   [5-26]: Public key (22 bytes from 28-byte P-224 key) - 22 bytes
- *   [27]:   First two bits of remaining key material - 1 byte
- *   [28]:   Hint byte - 1 byte
- *   Total: 2 + 1 + 1 + 1 + 22 + 1 + 1 = 29 bytes
- */
-static uint8_t apple_findmy_payload[APPLE_FINDMY_PAYLOAD_SIZE];
+	/* Apple FindMy only (or nothing) in quiet hours, the current protocol after */
+	err = start_advertising();
+	if (err) {
+		LOG_ERR("Failed to restart advertising (err %d)", err);
+		stats_inc(TAG_STAT_ADV_ERRORS);
+	}
+}
+#endif
+#endif /* CONFIG_TAG_EXT_ADV */
 
-static struct bt_data apple_ad[] = {
-	BT_DATA(BT_DATA_MANUFACTURER_DATA, apple_findmy_payload, APPLE_FINDMY_PAYLOAD_SIZE),
-};
+#if defined(CONFIG_TAG_BATTERY)
+/* New battery bucket (tag_work_q): patch the encoded bytes and reload the payloads */
+static void battery_changed(enum battery_level level)
+{
+	int err;
 
-/*
- * Google FMDN (Find My Device Network) Advertisement Format:
- * Adv Frame, see https://developers.google.com/nearby/fast-pair/specifications/extensions/fmdn#advertised-frames
- * - Uses Service Data with Eddystone UUID
- * - UUID: 0xFEAA (Eddystone)
- * - Frame type: 0x40 for standard FHN, 0x41 for unwanted tracking protection mode
- * - Payload structure:
- *   [0-1]:  Service UUID (0xFEAA little-endian: 0xAA, 0xFE) - 2 bytes
- *   [2]:    Frame type (0x40) - 1 byte
- *   [3-22]: Ephemeral Identifier (20 bytes, 160-bit ECC) - 20 bytes
- *   [23]:   Hashed flags byte - 1 byte
- *   Total: 2 + 1 + 20 + 1 = 24 bytes
- */
-#define GOOGLE_FMDN_PAYLOAD_SIZE 24
-static uint8_t google_fmdn_payload[GOOGLE_FMDN_PAYLOAD_SIZE];
+	battery_level = level;
+	apple_findmy_payload.status = apple_battery_status();
+	google_fmdn_payload[0].flags = google_battery_flags();
+	google_fmdn_payload[1].flags = google_battery_flags();
 
-static struct bt_data google_ad[] = {
-	BT_DATA_BYTES(BT_DATA_FLAGS, BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR),
-	BT_DATA(BT_DATA_SVC_DATA16, google_fmdn_payload, GOOGLE_FMDN_PAYLOAD_SIZE),
-};
+	err = refresh_adv_payloads();
+	if (err) {
+		LOG_ERR("Failed to update battery level in advertising (err %d)", err);
+	}
+}
+#endif
 
-/* Prepare Apple FindMy advertisement payload */
-static void prepare_apple_findmy_adv(void)
+#if defined(CONFIG_TAG_QUIET_HOURS)
+/* Quiet window boundary (tag_work_q): move the advertisers */
+static void quiet_changed(bool quiet)
 {
-	/* Apple Company ID (little-endian: 0x004C) */
-	apple_findmy_payload[0] = 0x4C;
-	apple_findmy_payload[1] = 0x00;
+	tag_quiet = quiet;
+	if (tag_state == TAG_STATE_BEACONING || tag_state == TAG_STATE_ROTATING) {
+		apply_quiet_hours();
+	}
+}
+#endif
+
+#if defined(CONFIG_TAG_RETAINED_RESUME)
+/* Beacon state kept in retained RAM, enough to go back on air after a warm reset */
+struct tag_resume {
+	struct tag_keys keys;
+	struct apple_findmy_frame apple_frame;
+	struct google_fmdn_frame google_frame;
+	uint8_t adv_profile;
+#if defined(CONFIG_TAG_KEY_TABLE)
+	uint32_t key_index;
+	uint32_t key_rotation_left_ms;
+#endif
+#if defined(CONFIG_TAG_FMDN_EID)
+	uint32_t beacon_clock;
+#endif
+#if !defined(CONFIG_TAG_EXT_ADV)
+	uint8_t protocol;
+	uint32_t slot_left_ms;
+#endif
+#if defined(CONFIG_TAG_QUIET_HOURS)
+	bool utc_valid;
+	uint32_t utc;
+	uint16_t quiet_window[2];
+#endif
+};
+
+BUILD_ASSERT(sizeof(struct tag_resume) <= RETAINED_DATA_MAX, "Resume snapshot too large");
 
-	/* Type: 0x12 for Offline Finding */
-	apple_findmy_payload[2] = 0x12;
+#if defined(CONFIG_TAG_KEY_TABLE) || !defined(CONFIG_TAG_EXT_ADV)
+static uint32_t remaining_ms(const struct k_work_delayable *dwork)
+{
+	return k_ticks_to_ms_floor32(k_work_delayable_remaining_get(dwork));
+}
+#endif
 
-	/* Length: 0x19 (25 bytes following) */
-	apple_findmy_payload[3] = 0x19;
+/* Refresh the snapshot (tag_work_q), everything in it only changes on this queue */
+static void resume_save_work_handler(struct k_work *work)
+{
+	struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+	struct tag_resume resume = {
+		.keys = beacon_keys,
+		.apple_frame = apple_findmy_payload,
+		.google_frame = google_fmdn_payload[google_payload_idx],
+		.adv_profile = adv_profile,
+	};
 
-	/* Status byte: 0x00 (no battery/motion info) */
-	apple_findmy_payload[4] = 0x00;
+#if defined(CONFIG_TAG_KEY_TABLE)
+	resume.key_index = key_index;
+	resume.key_rotation_left_ms = remaining_ms(&key_rotation_work);
+#endif
+#if defined(CONFIG_TAG_FMDN_EID)
+	resume.beacon_clock = beacon_clock();
+#endif
+#if !defined(CONFIG_TAG_EXT_ADV)
+	resume.protocol = current_protocol;
+	resume.slot_left_ms = remaining_ms(&protocol_switch_work);
+#if defined(CONFIG_TAG_QUIET_HOURS)
+	if (tag_quiet) {
+		resume.slot_left_ms = k_ticks_to_ms_floor32(protocol_slot_left);
+	}
+#endif
+#endif
+#if defined(CONFIG_TAG_QUIET_HOURS)
+	resume.utc_valid = (quiet_get_time(&resume.utc) == 0);
+	quiet_get_window(&resume.quiet_window[0], &resume.quiet_window[1]);
+#endif
 
-	/* Copy 22 bytes of a public key starting from byte 6 (bytes 6-27) */
-	memcpy(&apple_findmy_payload[5], &apple_key[6], 22);
+	retained_save(&resume, sizeof(resume));
+	k_work_schedule_for_queue(&tag_work_q, dwork, K_SECONDS(CONFIG_TAG_RETAINED_REFRESH_SEC));
+}
 
-	/* First two bits from key[0] (top 2 bits of the byte used in MAC) */
-	apple_findmy_payload[27] = (apple_key[0] >> 6) & 0x03;
+K_WORK_DELAYABLE_DEFINE(resume_save_work, resume_save_work_handler);
 
-	/* Hint byte: 0x00 */
-	apple_findmy_payload[28] = 0x00;
+/* Beacons are on air, snapshot them now and then every refresh period */
+static void start_resume_snapshots(void)
+{
+	k_work_reschedule_for_queue(&tag_work_q, &resume_save_work, K_NO_WAIT);
 }
 
-/* Prepare Google FMDN advertisement payload */
-static void prepare_google_fmdn_adv(void)
+/*
+ * Restore the beacon state from retained RAM before anything else runs,
+ * in place of the settings load. Keys go through the staging bits like
+ * any other source, so the beaconing path cannot tell the difference.
+ */
+static bool resume_from_retained(void)
 {
-	/* Eddystone Service UUID (little-endian: 0xFEAA) */
-	google_fmdn_payload[0] = 0xAA;
-	google_fmdn_payload[1] = 0xFE;
+	struct tag_resume resume;
 
-	/* Frame type: 0x40 for standard FHN (Find Hub Network) */
-	google_fmdn_payload[2] = 0x40;
+	if (retained_load(&resume, sizeof(resume)) || resume.adv_profile >= ADV_PROFILE_COUNT) {
+		return false;
+	}
 
-	/* Copy Ephemeral Identifier (20 bytes for 160-bit ECC) */
-	memcpy(&google_fmdn_payload[3], google_key, GOOGLE_KEY_SIZE);
+	memcpy(&key_staging, &resume.keys, sizeof(key_staging));
+	atomic_or(&key_staged, BIT(KEY_PART_APPLE_1) | BIT(KEY_PART_APPLE_2) | BIT(KEY_PART_GOOGLE));
+#if defined(CONFIG_TAG_FMDN_EID)
+	if (resume.keys.has_eik) {
+		atomic_set_bit(&key_staged, KEY_PART_EIK);
+	}
+#endif
+	if (!commit_keys()) {
+		return false;
+	}
+	keys_stored = true;
+	adv_profile = resume.adv_profile;
 
-	/* Hashed flags byte: 0x00 (no battery info, no unwanted tracking protection) */
-	google_fmdn_payload[23] = 0x00;
+	/* Both FMDN buffers, a precomputed EID only replaces the EID field */
+	apple_findmy_payload = resume.apple_frame;
+	google_fmdn_payload[0] = resume.google_frame;
+	google_fmdn_payload[1] = resume.google_frame;
+	google_payload_idx = 0;
+	resumed_payloads = true;
+#if defined(CONFIG_TAG_KEY_TABLE)
+	key_index = resume.key_index;
+	key_rotation_resume_ms = resume.key_rotation_left_ms;
+#endif
+#if defined(CONFIG_TAG_FMDN_EID)
+	beacon_clock_base = resume.beacon_clock - (uint32_t)(k_uptime_get() / MSEC_PER_SEC);
+	/* A rotation boundary went by since the snapshot, the EID is computed again */
+	if (resume.keys.has_eik && beacon_clock() / EID_ROTATION_PERIOD_SEC !=
+				       resume.beacon_clock / EID_ROTATION_PERIOD_SEC) {
+		resumed_payloads = false;
+	}
+#endif
+#if !defined(CONFIG_TAG_EXT_ADV)
+	if (resume.protocol == PROTOCOL_APPLE_FINDMY || resume.protocol == PROTOCOL_GOOGLE_FMDN) {
+		current_protocol = resume.protocol;
+		protocol_resume_ms = resume.slot_left_ms;
+	}
+#endif
+#if defined(CONFIG_TAG_QUIET_HOURS)
+	quiet_set_window(resume.quiet_window[0], resume.quiet_window[1]);
+	if (resume.utc_valid) {
+		quiet_set_time(resume.utc);
+	}
+#endif
+	return true;
 }
+#endif /* CONFIG_TAG_RETAINED_RESUME */
 
-/* Set BLE MAC address based on protocol (following Everytag implementation) */
-static void set_mac_address(void)
-{
-	uint8_t addr[6];
-	/* For Apple: derive MAC from the first 6 bytes of a public key */
-	/* Address bytes are reversed */
-	addr[5] = apple_key[0] | 0xC0; /* MSB with static random bits */
-	addr[4] = apple_key[1];
-	addr[3] = apple_key[2];
-	addr[2] = apple_key[3];
-	addr[1] = apple_key[4];
-	addr[0] = apple_key[5]; /* LSB */
+#if defined(CONFIG_TAG_FMDN_EID)
+/* How long before a rotation boundary the next EID is computed */
+#define EID_PRECOMPUTE_LEAD_SEC 30
 
-	bt_ctlr_set_public_addr(addr);
-}
+/*
+ * Boundaries between "tag/clk" writes, about every 68 min. A warm reset
+ * takes the clock from the retained snapshot; after a cold reset the EID
+ * sequence resumes at most this many periods back.
+ */
+#define EID_CLOCK_STORE_PERIODS 4
 
-/* Start advertising for the current protocol */
-static int start_advertising(void)
+/* Beacon clock value of the next EID rotation */
+static uint32_t eid_boundary;
+static bool next_eid_ready;
+
+static void eid_rotate_work_handler(struct k_work *work);
+K_WORK_DELAYABLE_DEFINE(eid_rotate_work, eid_rotate_work_handler);
+
+/* Seconds from now until beacon clock value t, 0 if already passed */
+static k_timeout_t beacon_clock_delay(uint32_t t)
 {
-	struct bt_le_adv_param adv_param = {
-		.id = 0,
-		.options = BT_LE_ADV_OPT_USE_IDENTITY,
-		.interval_min = BT_GAP_ADV_FAST_INT_MIN_2,
-		.interval_max = BT_GAP_ADV_FAST_INT_MAX_2,
-	};
+	const uint32_t now = beacon_clock();
 
-	int err;
+	return K_SECONDS(t > now ? t - now : 0);
+}
 
-	bt_le_adv_stop();
+/* Compute the EID for the next period into the payload buffer not on air */
+static void eid_precompute_work_handler(struct k_work *work)
+{
+	uint8_t eid[EID_SIZE];
+	const int err = eid_compute(beacon_keys.eik, eid_boundary, eid);
 
-	if (current_protocol == PROTOCOL_APPLE_FINDMY) {
-		prepare_apple_findmy_adv();
-		err = bt_le_adv_start(&adv_param, apple_ad, ARRAY_SIZE(apple_ad), NULL, 0);
+	if (err) {
+		LOG_ERR("EID precompute failed (err %d)", err);
+		stats_inc(TAG_STAT_EID_FAILURES);
 	} else {
-		prepare_google_fmdn_adv();
-		err = bt_le_adv_start(&adv_param, google_ad, ARRAY_SIZE(google_ad), NULL, 0);
+		prepare_google_fmdn_adv(&google_fmdn_payload[google_payload_idx ^ 1], eid);
+		next_eid_ready = true;
 	}
 
-	return err;
+	k_work_schedule_for_queue(&tag_work_q, &eid_rotate_work, beacon_clock_delay(eid_boundary));
 }
 
-/* Work item for protocol switching (runs in thread context) */
-static void protocol_switch_work_handler(struct k_work *work)
+K_WORK_DELAYABLE_DEFINE(eid_precompute_work, eid_precompute_work_handler);
+
+/* At the boundary the precomputed payload just becomes the active buffer */
+static void eid_rotate_work_handler(struct k_work *work)
 {
-	/* Switch protocol */
-	if (current_protocol == PROTOCOL_APPLE_FINDMY) {
-		current_protocol = PROTOCOL_GOOGLE_FMDN;
-		printk("Switching to Google FMDN\n");
-	} else {
-		current_protocol = PROTOCOL_APPLE_FINDMY;
-		printk("Switching to Apple FindMy\n");
+	int err;
+
+	set_tag_state(TAG_STATE_ROTATING);
+	if (next_eid_ready) {
+		google_payload_idx ^= 1;
+		next_eid_ready = false;
+		err = refresh_google_adv();
+		if (err) {
+			LOG_ERR("Failed to update FMDN advertising (err %d)", err);
+		}
 	}
 
-	/* Restart advertising with a new protocol payload */
-	const int err = start_advertising();
-	if (err) {
-		printk("Failed to restart advertising (err %d)\n", err);
+	/* Persist the clock now and then so the EID sequence continues after a reset */
+	if ((eid_boundary / EID_ROTATION_PERIOD_SEC) % EID_CLOCK_STORE_PERIODS == 0) {
+		err = settings_save_one("tag/clk", &eid_boundary, sizeof(eid_boundary));
+		if (err) {
+			LOG_ERR("Failed to store beacon clock (err %d)", err);
+		}
 	}
-}
 
-K_WORK_DEFINE(protocol_switch_work, protocol_switch_work_handler);
+	eid_boundary += EID_ROTATION_PERIOD_SEC;
+	k_work_schedule_for_queue(&tag_work_q, &eid_precompute_work,
+				  beacon_clock_delay(eid_boundary - EID_PRECOMPUTE_LEAD_SEC));
+	set_tag_state(TAG_STATE_BEACONING);
+}
 
-/* Protocol switcher timer callback (runs in ISR context) */
-static void protocol_switcher(struct k_timer *timer)
+/* The current EID is already on air, schedule the next one */
+static void start_eid_rotation(void)
 {
-	/* Submit work to the system work queue (will run in thread context) */
-	k_work_submit(&protocol_switch_work);
+	eid_boundary = (beacon_clock() | (EID_ROTATION_PERIOD_SEC - 1)) + 1;
+	next_eid_ready = false;
+	k_work_schedule_for_queue(&tag_work_q, &eid_precompute_work,
+				  beacon_clock_delay(eid_boundary - EID_PRECOMPUTE_LEAD_SEC));
 }
+#endif /* CONFIG_TAG_FMDN_EID */
 
+#if defined(CONFIG_TAG_PROV_GATT)
 /* Start advertising as an unconfigured device */
 static void start_config_advertising(void)
 {
 	const int err = bt_le_adv_start(BT_LE_ADV_CONN_FAST_1, config_ad, ARRAY_SIZE(config_ad), config_sd, ARRAY_SIZE(config_sd));
 	if (err) {
-		printk("Advertising failed to start (err %d)\n", err);
+		LOG_ERR("Advertising failed to start (err %d)", err);
 	} else {
-		printk("Advertising started\n");
+		LOG_INF("Advertising started");
 	}
 }
 
@@ -296,105 +2075,437 @@ static void start_config_advertising(void)
 static void config_connected(struct bt_conn *conn, uint8_t err)
 {
 	if (err) {
-		printk("Connection failed (err %d)\n", err);
+		LOG_WRN("Connection failed (err %d)", err);
 		return;
 	}
 	char addr[BT_ADDR_LE_STR_LEN];
 	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
-	printk("Connected %s\n", addr);
+	LOG_INF("Connected %s", addr);
+	if (!config_conn) {
+		config_conn = bt_conn_ref(conn);
+	}
+
+	/* Only config mode is connectable: trade power for a short provisioning session */
+	int rc = bt_conn_le_phy_update(conn, BT_CONN_LE_PHY_PARAM_2M);
+	if (rc) {
+		LOG_DBG("PHY update request failed (err %d)", rc);
+	}
+	rc = bt_conn_le_data_len_update(conn, BT_LE_DATA_LEN_PARAM_MAX);
+	if (rc) {
+		LOG_DBG("Data length update request failed (err %d)", rc);
+	}
+	/* 7.5-15 ms interval, no latency, 4 s supervision timeout */
+	rc = bt_conn_le_param_update(conn, BT_LE_CONN_PARAM(6, 12, 0, 400));
+	if (rc) {
+		LOG_DBG("Connection parameter update request failed (err %d)", rc);
+	}
 }
 
 static void config_disconnected(struct bt_conn *conn, uint8_t reason)
 {
-	printk("Disconnected (reason %d)\n", reason);
+	LOG_INF("Disconnected (reason %d)", reason);
+	if (conn != config_conn) {
+		return;
+	}
+	bt_conn_unref(config_conn);
+	config_conn = NULL;
+
+	/* Provisioned in this connection: no need to wait for the verify timeout */
+	if (k_work_delayable_is_pending(&start_advertising_work)) {
+		k_work_reschedule_for_queue(&tag_work_q, &start_advertising_work, K_NO_WAIT);
+	}
 }
 
 BT_CONN_CB_DEFINE(config_conn_callbacks) = {
 	.connected = config_connected,
 	.disconnected = config_disconnected
 };
+#endif /* CONFIG_TAG_PROV_GATT */
+
+#if defined(CONFIG_TAG_PROV_SCAN)
+/*
+ * Handle one provisioning frame; payload is what follows the company ID.
+ * Stations repeat their frames, so each part is staged once and frames
+ * still in flight after the commit are dropped.
+ */
+static void handle_provisioning_frame(uint8_t type, const uint8_t *payload, uint8_t len)
+{
+	if (keys_received()) {
+		return;
+	}
+
+	if (type == 0xf1 && len == 20 && !atomic_test_bit(&key_staged, KEY_PART_APPLE_1)) {
+		memcpy(key_staging.apple, payload, 20);
+		atomic_set_bit(&key_staged, KEY_PART_APPLE_1);
+		LOG_DBG("apple 1st part received");
+		check_keys_and_start();
+	} else if (type == 0xf2 && len == 8 && !atomic_test_bit(&key_staged, KEY_PART_APPLE_2)) {
+		memcpy(&key_staging.apple[20], payload, 8);
+		atomic_set_bit(&key_staged, KEY_PART_APPLE_2);
+		LOG_DBG("apple 2nd part received");
+		check_keys_and_start();
+	} else if (type == 0xf3 && len == 20 && !atomic_test_bit(&key_staged, KEY_PART_GOOGLE)) {
+		memcpy(key_staging.google, payload, 20);
+		atomic_set_bit(&key_staged, KEY_PART_GOOGLE);
+		LOG_DBG("google received");
+		check_keys_and_start();
+	} else if (type == 0xf6 && len == 1 && payload[0] < ADV_PROFILE_COUNT) {
+		set_adv_profile(payload[0]);
+	}
+#if defined(CONFIG_TAG_QUIET_HOURS)
+	else if (type == 0xf7 && len == QUIET_HOURS_SIZE &&
+		 !atomic_test_bit(&key_staged, KEY_PART_QUIET) && set_quiet_hours(payload)) {
+		atomic_set_bit(&key_staged, KEY_PART_QUIET);
+		LOG_DBG("quiet hours received");
+	}
+#endif
+#if defined(CONFIG_TAG_FMDN_EID)
+	/* Identity key in two frames: 20 bytes, then 12 bytes */
+	else if (type == 0xf4 && len == 20 && !atomic_test_bit(&key_staged, KEY_PART_EIK_1)) {
+		memcpy(key_staging.eik, payload, 20);
+		atomic_set_bit(&key_staged, KEY_PART_EIK_1);
+		LOG_DBG("google identity key 1st part received");
+	} else if (type == 0xf5 && len == 12 && atomic_test_bit(&key_staged, KEY_PART_EIK_1) &&
+		   !atomic_test_bit(&key_staged, KEY_PART_EIK)) {
+		memcpy(&key_staging.eik[20], payload, 12);
+		atomic_set_bit(&key_staged, KEY_PART_EIK);
+		LOG_DBG("google identity key 2nd part received");
+		check_keys_and_start();
+	}
+#endif
+}
 
+/*
+ * Provisioning frames (manufacturer data):
+ *   [0]:   Frame type 0xf1-0xf7, or 0xe1-0xe7 for the addressed variant
+ *   [1]:   0xff (company ID 0xFFxx)
+ *   [2-5]: Addressed variant only: target device ID (see device_id)
+ *   [..]:  Frame payload
+ * Addressed frames let one broadcaster stream keys for many tags at once,
+ * each tag only takes the frames carrying its own ID.
+ */
 static bool adv_data_found(struct bt_data *data, void *user_data)
 {
-	if (data->type == BT_DATA_MANUFACTURER_DATA) {
-		if (data->data[1] == 0xff) {
-			if (data->data[0] == 0xf1 && data->data_len == 22 && apple_key_part1_received == false) {
-				apple_key_part1_received = true;
-				memcpy(apple_key, &data->data[2], 20);
-				check_keys_and_start();
-				printk("apple 1st part received\n");
-			} else if (data->data[0] == 0xf2 && data->data_len == 10 && apple_key_part2_received == false) {
-				apple_key_part2_received = true;
-				memcpy(&apple_key[20], &data->data[2], 8);
-				check_keys_and_start();
-				printk("apple 2nd part received\n");
-			} else if (data->data[0] == 0xf3 && data->data_len == 22 && google_key_received == false) {
-				google_key_received = true;
-				memcpy(google_key, &data->data[2], 20);
-				printk("google received\n");
-				check_keys_and_start();
+	if (data->type != BT_DATA_MANUFACTURER_DATA || data->data_len < 2 || data->data[1] != 0xff) {
+		return true;
+	}
+
+	const uint8_t type = data->data[0];
+
+	if (type >= 0xf1 && type <= 0xf7) {
+#if !defined(CONFIG_TAG_PROV_ADDRESSED_ONLY)
+		handle_provisioning_frame(type, &data->data[2], data->data_len - 2);
+#endif
+	} else if (type >= 0xe1 && type <= 0xe7 && data->data_len >= 2 + DEVICE_ID_SIZE &&
+		   memcmp(&data->data[2], device_id, DEVICE_ID_SIZE) == 0) {
+		handle_provisioning_frame(type + 0x10, &data->data[2 + DEVICE_ID_SIZE],
+					  data->data_len - 2 - DEVICE_ID_SIZE);
+	}
+	return true;
+}
+
+/*
+ * Provisioning frames are manufacturer data with company ID 0xFFF1-0xFFF7
+ * (first byte 0xf1-0xf7, second byte 0xff), or 0xFFE1-0xFFE7 followed by
+ * our device ID. Walk the raw AD structures looking for one, without
+ * copying or parsing anything else; frames for other tags stop here too.
+ */
+static bool has_provisioning_frame(const struct net_buf_simple *ad)
+{
+	const uint8_t *p = ad->data;
+	const uint8_t *end = ad->data + ad->len;
+
+	while (p + 1 < end && p[0] != 0) {
+		const uint8_t len = p[0];
+
+		if (p + 1 + len > end) {
+			break;
+		}
+		if (len >= 3 && p[1] == BT_DATA_MANUFACTURER_DATA && p[3] == 0xff) {
+			if (p[2] >= 0xf1 && p[2] <= 0xf7) {
+				return true;
+			}
+			if (p[2] >= 0xe1 && p[2] <= 0xe7 && len >= 3 + DEVICE_ID_SIZE &&
+			    memcmp(&p[4], device_id, DEVICE_ID_SIZE) == 0) {
+				return true;
 			}
 		}
+		p += 1 + len;
 	}
-	return true;
+	return false;
 }
 
 static void scan_cb(const bt_addr_le_t *addr, const int8_t rssi, const uint8_t type,
             struct net_buf_simple *ad)
 {
-	char addr_str[BT_ADDR_LE_STR_LEN];
-	bt_addr_le_to_str(addr, addr_str, sizeof(addr_str));
-	bt_data_parse(ad, adv_data_found, &addr_str);
+	stats_inc(TAG_STAT_SCAN_SEEN);
+
+	/* Fast path: drop everything that is not a provisioning frame */
+	if (!has_provisioning_frame(ad)) {
+		return;
+	}
+
+	stats_inc(TAG_STAT_SCAN_ACCEPTED);
+	bt_data_parse(ad, adv_data_found, NULL);
 }
 
-/* Start scanning for peripherals with our service */
-static void start_scan(void)
+/* Scan interval and window are in units of 0.625 ms */
+#define SCAN_MS_TO_UNITS(ms) ((ms) * 1000 / 625)
+
+/*
+ * Provisioning scan phases: a fast burst right after boot, then a low duty
+ * cycle scan, then (CONFIG_TAG_PROV_TIMEOUT) system off until a wake event.
+ */
+enum scan_phase {
+	SCAN_PHASE_FAST,
+	SCAN_PHASE_SLOW,
+};
+
+static enum scan_phase scan_phase;
+
+#if defined(CONFIG_TAG_PROV_STATION_FILTER)
+/* Let the controller drop reports from everything but the provisioning station */
+static int setup_station_filter(void)
+{
+	bt_addr_le_t station;
+	int err;
+
+	err = bt_addr_le_from_str(CONFIG_TAG_PROV_STATION_ADDR, CONFIG_TAG_PROV_STATION_ADDR_TYPE,
+				  &station);
+	if (err) {
+		LOG_ERR("Invalid provisioning station address (err %d)", err);
+		return err;
+	}
+
+	bt_le_filter_accept_list_clear();
+	return bt_le_filter_accept_list_add(&station);
+}
+#endif
+
+static int start_scan_with(uint16_t interval, uint16_t window)
 {
-	const struct bt_le_scan_param scan_param = {
+	struct bt_le_scan_param scan_param = {
 		.type = BT_LE_SCAN_TYPE_PASSIVE,
 		.options = BT_LE_SCAN_OPT_FILTER_DUPLICATE,
-		.interval = BT_GAP_SCAN_FAST_INTERVAL,
-		.window = BT_GAP_SCAN_FAST_WINDOW
+		.interval = interval,
+		.window = window
 	};
-	const int err = bt_le_scan_start(&scan_param, scan_cb);
+
+#if defined(CONFIG_TAG_PROV_STATION_FILTER)
+	if (setup_station_filter() == 0) {
+		scan_param.options |= BT_LE_SCAN_OPT_FILTER_ACCEPT_LIST;
+	}
+#endif
+
+	return bt_le_scan_start(&scan_param, scan_cb);
+}
+
+#if defined(CONFIG_TAG_PROV_TIMEOUT)
+/* Nobody provisioned us: stop the radio and sleep until a wake event */
+static void provisioning_poweroff(void)
+{
+	LOG_WRN("Provisioning timed out, powering off");
+	bt_le_scan_stop();
+	bt_le_adv_stop();
+
+#if DT_NODE_HAS_STATUS(DT_ALIAS(sw0), okay)
+	static const struct gpio_dt_spec button = GPIO_DT_SPEC_GET(DT_ALIAS(sw0), gpios);
+
+	if (gpio_is_ready_dt(&button)) {
+		gpio_pin_configure_dt(&button, GPIO_INPUT);
+		/* Level sense is what wakes the SoC from system off */
+		gpio_pin_interrupt_configure_dt(&button, GPIO_INT_LEVEL_ACTIVE);
+	}
+#endif
+#if defined(CONFIG_TAG_PROV_WAKE_NFC)
+	/* Wake on NFC field detect */
+	nrf_nfct_task_trigger(NRF_NFCT, NRF_NFCT_TASK_SENSE);
+#endif
+
+	sys_poweroff();
+}
+#endif
+
+static void scan_phase_work_handler(struct k_work *work)
+{
+	struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+
+	if (scan_phase == SCAN_PHASE_FAST) {
+		bt_le_scan_stop();
+		const int err = start_scan_with(SCAN_MS_TO_UNITS(CONFIG_TAG_PROV_SLOW_SCAN_INTERVAL_MS),
+						SCAN_MS_TO_UNITS(CONFIG_TAG_PROV_SLOW_SCAN_WINDOW_MS));
+		if (err) {
+			LOG_ERR("Slow scan failed to start (err %d)", err);
+		} else {
+			LOG_INF("Provisioning scan backed off (%d ms every %d ms)",
+				CONFIG_TAG_PROV_SLOW_SCAN_WINDOW_MS, CONFIG_TAG_PROV_SLOW_SCAN_INTERVAL_MS);
+		}
+		scan_phase = SCAN_PHASE_SLOW;
+#if defined(CONFIG_TAG_PROV_TIMEOUT)
+		/* The timeout counts from the start of the fast burst */
+		k_work_schedule_for_queue(&tag_work_q, dwork,
+					  K_SECONDS(MAX(CONFIG_TAG_PROV_TIMEOUT_MIN * 60 -
+							CONFIG_TAG_PROV_FAST_SCAN_SEC, 0)));
+#endif
+		return;
+	}
+
+#if defined(CONFIG_TAG_PROV_TIMEOUT)
+	provisioning_poweroff();
+#endif
+	ARG_UNUSED(dwork);
+}
+
+K_WORK_DELAYABLE_DEFINE(scan_phase_work, scan_phase_work_handler);
+
+/* Start scanning for peripherals with our service */
+static void start_scan(void)
+{
+	const int err = start_scan_with(BT_GAP_SCAN_FAST_INTERVAL, BT_GAP_SCAN_FAST_WINDOW);
 	if (err) {
-		printk("Scanning failed to start (err %d)\n", err);
+		LOG_ERR("Scanning failed to start (err %d)", err);
 		return;
 	}
-	printk("Scanning successfully started\n");
+	LOG_INF("Scanning successfully started");
+
+	scan_phase = SCAN_PHASE_FAST;
+	k_work_schedule_for_queue(&tag_work_q, &scan_phase_work, K_SECONDS(CONFIG_TAG_PROV_FAST_SCAN_SEC));
+}
+
+/* Provisioning is done, stop scanning and cancel the pending phase change */
+static int stop_scan(void)
+{
+	k_work_cancel_delayable(&scan_phase_work);
+	LOG_INF("Provisioning scan: %u reports seen, %u accepted",
+		stats_get(TAG_STAT_SCAN_SEEN), stats_get(TAG_STAT_SCAN_ACCEPTED));
+	return bt_le_scan_stop();
 }
+#endif /* CONFIG_TAG_PROV_SCAN */
 
+#if !defined(CONFIG_TAG_BUILTIN_KEYS)
 /* Wait for configuration over BLE */
 static void wait_for_configuration(void)
 {
-	printk("HYBRID TAG\n");
-	#ifdef CONFIG_ADVERTISE
+	LOG_INF("HYBRID TAG");
+	set_tag_state(TAG_STATE_PROVISIONING);
+#if defined(CONFIG_TAG_KEY_UPLOAD)
+	int err = key_upload_init(key_table_changed);
+	if (err) {
+		LOG_ERR("Key upload init failed (err %d)", err);
+	}
+#endif
+#if defined(CONFIG_TAG_PROV_GATT)
 	start_config_advertising();
-	#endif
+#elif defined(CONFIG_TAG_PROV_SCAN)
+	start_id_advertising();
+#endif
+#if defined(CONFIG_TAG_PROV_SCAN)
 	start_scan();
+#endif
 }
+#endif
 
-static void bt_ready(int err)
+/* First lifecycle step once Bluetooth is up: provision, or beacon with stored keys */
+static void boot_work_handler(struct k_work *work)
 {
+#if defined(CONFIG_TAG_KEY_TABLE)
+	/* Validated once here and after an upload, everything else only reads the count */
+	(void)key_table_init();
+#endif
+	if (resumed) {
+		LOG_INF("Warm reset, resuming beacons");
+		k_work_reschedule_for_queue(&tag_work_q, &start_advertising_work, K_NO_WAIT);
+		return;
+	}
+#if defined(CONFIG_TAG_BUILTIN_KEYS)
+	const int err = load_builtin_keys();
+
 	if (err) {
-		printk("Bluetooth ready failed (err %d)\n", err);
+		LOG_ERR("Invalid built-in keys (err %d)", err);
 		return;
 	}
-	if (!device_configured) {
+	LOG_INF("Using built-in keys");
+#else
+	if (!keys_received()) {
 		wait_for_configuration();
 		return;
 	}
-	printk("Device already configured\n");
-	k_timer_start(&protocol_timer, K_SECONDS(PROTOCOL_SWITCH_INTERVAL_SEC),K_SECONDS(PROTOCOL_SWITCH_INTERVAL_SEC));
-	printk("Protocol switcher timer started (interval: %d seconds)\n", PROTOCOL_SWITCH_INTERVAL_SEC);
+	LOG_INF("Device already configured");
+#endif
+	k_work_reschedule_for_queue(&tag_work_q, &start_advertising_work, K_NO_WAIT);
+}
+
+K_WORK_DEFINE(boot_work, boot_work_handler);
+
+static void bt_ready(int err)
+{
+	if (err) {
+		LOG_ERR("Bluetooth ready failed (err %d)", err);
+		return;
+	}
+	k_work_submit_to_queue(&tag_work_q, &boot_work);
 }
 
 int main(void)
 {
-	printk("Hybrid Tag starting...\n");
-	const int err = bt_enable(bt_ready);
+	LOG_INF("Hybrid Tag starting...");
+#if defined(CONFIG_TAG_BENCH_MARKERS)
+	if (bench_init()) {
+		LOG_ERR("Bench markers init failed");
+	}
+#endif
+#if !defined(CONFIG_TAG_BUILTIN_KEYS)
+	read_device_id();
+#endif
+
+	k_work_queue_start(&tag_work_q, tag_work_q_stack, K_THREAD_STACK_SIZEOF(tag_work_q_stack),
+			   CONFIG_TAG_WORKQUEUE_PRIORITY, &(const struct k_work_queue_config){
+				   .name = "tag_wq",
+			   });
+
+#if defined(CONFIG_TAG_FMDN_EID)
+	if (eid_init()) {
+		LOG_ERR("PSA crypto init failed");
+	}
+#endif
+
+#if defined(CONFIG_TAG_RETAINED_RESUME)
+	/* After a warm reset the snapshot stands in for everything under "tag/" */
+	resumed = resume_from_retained();
+#endif
+
+	/* Load stored keys before Bluetooth comes up so bt_ready sees them */
+	int err = settings_subsys_init();
+	if (err) {
+		LOG_ERR("Settings init failed (err %d)", err);
+	} else if (!resumed) {
+		settings_load_subtree("tag");
+	}
+
+#if defined(CONFIG_TAG_BATTERY)
+	err = battery_init(battery_changed);
+	if (err) {
+		LOG_ERR("Battery monitor init failed (err %d)", err);
+	}
+#endif
+
+#if defined(CONFIG_TAG_QUIET_HOURS)
+	err = quiet_init(quiet_changed);
+	if (err) {
+		LOG_ERR("Quiet hours init failed (err %d)", err);
+	}
+#endif
+
+#if defined(CONFIG_TAG_MOTION)
+	err = motion_init(motion_changed);
+	if (err) {
+		LOG_ERR("Motion detection init failed (err %d)", err);
+	}
+#endif
+
+	err = bt_enable(bt_ready);
 	if (err) {
-		printk("Bluetooth init failed (err %d)\n", err);
+		LOG_ERR("Bluetooth init failed (err %d)", err);
 		return err;
 	}
 	return 0;
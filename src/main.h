@@ -9,7 +9,13 @@
 /* Google FMDN can use 20-byte (160-bit) or 32-byte (256-bit) keys */
 #define GOOGLE_KEY_SIZE 20
 
-#define PROTOCOL_SWITCH_INTERVAL_SEC 60
+/* Advertising interval profiles, selected at provisioning time */
+typedef enum {
+    ADV_PROFILE_FAST,      /* 100-150 ms */
+    ADV_PROFILE_BALANCED,  /* ~1 s */
+    ADV_PROFILE_LONGEVITY, /* ~2 s */
+    ADV_PROFILE_COUNT,
+} adv_profile_t;
 
 #define BT_UUID_CUSTOM_SERVICE_VAL BT_UUID_128_ENCODE(0x12345678, 0x1234, 0x5678, 0x1234, 0x56789abcdef0)
 static const struct bt_uuid_128 config_service_uuid = BT_UUID_INIT_128(BT_UUID_CUSTOM_SERVICE_VAL);
@@ -20,7 +26,67 @@ static const struct bt_uuid_128 write_apple_key_cmd_uuid = BT_UUID_INIT_128(
 static const struct bt_uuid_128 write_google_key_cmd_uuid = BT_UUID_INIT_128(
     BT_UUID_128_ENCODE(0x12345678, 0x1234, 0x5678, 0x1234, 0x56789abcdef2));
 
-#define APPLE_FINDMY_PAYLOAD_SIZE 29
+static const struct bt_uuid_128 adv_profile_uuid = BT_UUID_INIT_128(
+    BT_UUID_128_ENCODE(0x12345678, 0x1234, 0x5678, 0x1234, 0x56789abcdef4));
+
+static const struct bt_uuid_128 write_google_eik_cmd_uuid = BT_UUID_INIT_128(
+    BT_UUID_128_ENCODE(0x12345678, 0x1234, 0x5678, 0x1234, 0x56789abcdef3));
+
+static const struct bt_uuid_128 write_prov_blob_cmd_uuid = BT_UUID_INIT_128(
+    BT_UUID_128_ENCODE(0x12345678, 0x1234, 0x5678, 0x1234, 0x56789abcdef5));
+
+/*
+ * Provisioning blob, written in one (long) write to write_prov_blob_cmd_uuid:
+ *   [0]:      Version (PROV_BLOB_VERSION)
+ *   [1]:      Flags (PROV_BLOB_FLAG_EIK: Google field is a 32-byte EIK)
+ *   [2]:      Advertising profile (PROV_BLOB_PROFILE_KEEP leaves it unchanged)
+ *   [3-30]:   Apple key
+ *   [31-50]:  Google key, or [31-62] identity key
+ *   [last 4]: CRC32 (IEEE) of the preceding bytes, little endian
+ */
+#define PROV_BLOB_VERSION 1
+#define PROV_BLOB_FLAG_EIK BIT(0)
+#define PROV_BLOB_PROFILE_KEEP 0xFF
+#define PROV_BLOB_HEADER_SIZE 3
+#define PROV_BLOB_EIK_SIZE 32
+#define PROV_BLOB_CRC_SIZE 4
+#define PROV_BLOB_MAX_SIZE (PROV_BLOB_HEADER_SIZE + APPLE_KEY_SIZE + PROV_BLOB_EIK_SIZE + PROV_BLOB_CRC_SIZE)
+
+static const struct bt_uuid_128 read_prov_digest_uuid = BT_UUID_INIT_128(
+    BT_UUID_128_ENCODE(0x12345678, 0x1234, 0x5678, 0x1234, 0x56789abcdef6));
+
+/*
+ * Provisioning digest, read back by the provisioning tool before it disconnects:
+ *   [0-3]: CRC32 (IEEE) of the Apple key followed by the Google key or EIK
+ *   [4]:   Advertising profile
+ *   [5]:   Flags (PROV_DIGEST_FLAG_*)
+ *   [6-9]: Key table size, 0 without a table
+ */
+#define PROV_DIGEST_SIZE 10
+#define PROV_DIGEST_FLAG_COMPLETE BIT(0)
+#define PROV_DIGEST_FLAG_EIK BIT(1)
+
+/* Beaconing waits this long for a connected provisioning client to verify and disconnect */
+#define PROV_VERIFY_TIMEOUT_SEC 10
+
+/* Runtime counters, TAG_STAT_COUNT little-endian uint32 values (see stats.h) */
+static const struct bt_uuid_128 read_stats_uuid = BT_UUID_INIT_128(
+    BT_UUID_128_ENCODE(0x12345678, 0x1234, 0x5678, 0x1234, 0x56789abcdef7));
+
+/*
+ * Quiet hours (CONFIG_TAG_QUIET_HOURS), also the payload of scan frame 0xf7:
+ *   [0-3]: Current UTC time in Unix seconds
+ *   [4-5]: Window start in minutes after UTC midnight
+ *   [6-7]: Window end in minutes after UTC midnight, equal to start for none
+ * All little endian. Reads return 0 as the time until one was set.
+ */
+static const struct bt_uuid_128 quiet_hours_uuid = BT_UUID_INIT_128(
+    BT_UUID_128_ENCODE(0x12345678, 0x1234, 0x5678, 0x1234, 0x56789abcdef8));
+
+#define QUIET_HOURS_SIZE 8
+
+/* Addressed provisioning frames carry the truncated hardware device ID */
+#define DEVICE_ID_SIZE 4
 
 /* Protocol selection */
 typedef enum {
@@ -28,11 +94,36 @@ typedef enum {
     PROTOCOL_GOOGLE_FMDN,
 } protocol_t;
 
-static void protocol_switcher(struct k_timer *timer);
-
-K_TIMER_DEFINE(protocol_timer, protocol_switcher, NULL);
+/* Tag lifecycle, see set_tag_state() for the allowed transitions */
+typedef enum {
+    TAG_STATE_UNPROVISIONED,    /* Booting, no keys committed yet */
+    TAG_STATE_PROVISIONING,     /* Scanning (or connectable) for keys */
+    TAG_STATE_BEACONING,        /* Keys committed, beacons on air */
+    TAG_STATE_ROTATING,         /* Beaconing, moving to the next key or EID */
+} tag_state_t;
 
-static void set_mac_address(void);
+#if !defined(CONFIG_TAG_EXT_ADV)
 static int start_advertising(void);
+#endif
+
+static int set_mac_address(void);
+static void prepare_adv_payloads(void);
+#if !defined(CONFIG_TAG_BUILTIN_KEYS) || defined(CONFIG_TAG_MOTION)
+static void apply_adv_profile(void);
+#endif
+
+#if defined(CONFIG_TAG_FMDN_EID)
+static void start_eid_rotation(void);
+#endif
+static void start_beaconing(void);
+#if defined(CONFIG_TAG_KEY_TABLE)
+static int restart_apple_adv(void);
+#endif
+#if defined(CONFIG_TAG_PROV_SCAN)
 static void start_scan(void);
+static int stop_scan(void);
+#endif
+#if defined(CONFIG_TAG_RETAINED_RESUME)
+static void start_resume_snapshots(void);
+#endif
 #endif /* MAIN_H */
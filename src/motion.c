@@ -0,0 +1,72 @@
+/* motion.c - Moving/stationary detection from an accelerometer interrupt */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/logging/log.h>
+
+#include "motion.h"
+#include "tag_work.h"
+
+LOG_MODULE_REGISTER(motion, CONFIG_TAG_LOG_LEVEL);
+
+static const struct device *const accel = DEVICE_DT_GET(DT_ALIAS(accel0));
+
+static motion_handler_t motion_handler;
+static atomic_t moving = ATOMIC_INIT(1);
+
+static void moving_work_handler(struct k_work *work)
+{
+	motion_handler(true);
+}
+
+static void stationary_work_handler(struct k_work *work)
+{
+	if (atomic_cas(&moving, 1, 0)) {
+		motion_handler(false);
+	}
+}
+
+K_WORK_DEFINE(moving_work, moving_work_handler);
+K_WORK_DELAYABLE_DEFINE(stationary_work, stationary_work_handler);
+
+/* Runs in the driver's trigger context, only hands off to the workqueue */
+static void motion_trigger_handler(const struct device *dev, const struct sensor_trigger *trig)
+{
+	k_work_reschedule_for_queue(&tag_work_q, &stationary_work,
+				    K_SECONDS(CONFIG_TAG_MOTION_STATIONARY_SEC));
+	if (atomic_cas(&moving, 0, 1)) {
+		k_work_submit_to_queue(&tag_work_q, &moving_work);
+	}
+}
+
+int motion_init(motion_handler_t handler)
+{
+	static const struct sensor_trigger trig = {
+		.type = SENSOR_TRIG_MOTION,
+		.chan = SENSOR_CHAN_ACCEL_XYZ,
+	};
+	int err;
+
+	if (!device_is_ready(accel)) {
+		return -ENODEV;
+	}
+
+	motion_handler = handler;
+	err = sensor_trigger_set(accel, &trig, motion_trigger_handler);
+	if (err) {
+		return err;
+	}
+
+	/* Without any motion after boot the tag settles to stationary */
+	k_work_reschedule_for_queue(&tag_work_q, &stationary_work,
+				    K_SECONDS(CONFIG_TAG_MOTION_STATIONARY_SEC));
+	LOG_INF("Motion detection armed on %s", accel->name);
+	return 0;
+}
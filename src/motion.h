@@ -0,0 +1,17 @@
+#ifndef MOTION_H
+#define MOTION_H
+
+#include <stdbool.h>
+
+/*
+ * Motion detection from the accel0 devicetree sensor. The sensor's motion
+ * interrupt marks the tag as moving, CONFIG_TAG_MOTION_STATIONARY_SEC
+ * without one marks it stationary. Nothing is polled: the handler runs on
+ * tag_work_q only when the state changes.
+ */
+typedef void (*motion_handler_t)(bool moving);
+
+/* Arm the motion trigger, the tag starts out as moving */
+int motion_init(motion_handler_t handler);
+
+#endif /* MOTION_H */
@@ -0,0 +1,139 @@
+/* quiet.c - Daily quiet window from a provisioned wall clock */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include "quiet.h"
+#include "tag_work.h"
+
+LOG_MODULE_REGISTER(quiet, CONFIG_TAG_LOG_LEVEL);
+
+#define SEC_PER_DAY (QUIET_MINUTES_PER_DAY * 60U)
+
+/* Unix time at uptime 0 once utc_valid, and the window, guarded by quiet_lock */
+static struct k_spinlock quiet_lock;
+static int64_t utc_base;
+static bool utc_valid;
+static uint16_t window_start;
+static uint16_t window_end;
+
+/* Handler and last reported state, tag_work_q only */
+static quiet_handler_t quiet_handler;
+static bool quiet;
+
+static void quiet_work_handler(struct k_work *work);
+
+K_WORK_DELAYABLE_DEFINE(quiet_work, quiet_work_handler);
+
+static bool in_window(uint32_t minute, uint16_t start, uint16_t end)
+{
+	if (start <= end) {
+		return minute >= start && minute < end;
+	}
+	return minute >= start || minute < end;
+}
+
+/* Seconds from second of day now to the start of minute at, today or tomorrow */
+static uint32_t seconds_until(uint32_t now, uint16_t at)
+{
+	const uint32_t t = at * 60U;
+
+	return t > now ? t - now : t + SEC_PER_DAY - now;
+}
+
+/* Report the state, then sleep until the next boundary */
+static void quiet_work_handler(struct k_work *work)
+{
+	k_spinlock_key_t key = k_spin_lock(&quiet_lock);
+	const bool active = utc_valid && window_start != window_end;
+	const uint32_t now = (utc_base + k_uptime_get() / MSEC_PER_SEC) % SEC_PER_DAY;
+	const uint16_t start = window_start;
+	const uint16_t end = window_end;
+	bool in = false;
+
+	k_spin_unlock(&quiet_lock, key);
+
+	if (active) {
+		in = in_window(now / 60U, start, end);
+		k_work_schedule_for_queue(&tag_work_q, &quiet_work,
+					  K_SECONDS(seconds_until(now, in ? end : start)));
+	}
+
+	if (in != quiet) {
+		quiet = in;
+		LOG_INF("Quiet hours %s", in ? "started" : "ended");
+		quiet_handler(in);
+	}
+}
+
+/* Settings are loaded before quiet_init(), the first evaluation happens there */
+static void quiet_reevaluate(void)
+{
+	if (quiet_handler) {
+		k_work_reschedule_for_queue(&tag_work_q, &quiet_work, K_NO_WAIT);
+	}
+}
+
+void quiet_set_window(uint16_t start_min, uint16_t end_min)
+{
+	k_spinlock_key_t key = k_spin_lock(&quiet_lock);
+
+	window_start = start_min;
+	window_end = end_min;
+	k_spin_unlock(&quiet_lock, key);
+
+	LOG_INF("Quiet hours %02u:%02u-%02u:%02u UTC", start_min / 60U, start_min % 60U,
+		end_min / 60U, end_min % 60U);
+	quiet_reevaluate();
+}
+
+void quiet_get_window(uint16_t *start_min, uint16_t *end_min)
+{
+	k_spinlock_key_t key = k_spin_lock(&quiet_lock);
+
+	*start_min = window_start;
+	*end_min = window_end;
+	k_spin_unlock(&quiet_lock, key);
+}
+
+void quiet_set_time(uint32_t utc)
+{
+	k_spinlock_key_t key = k_spin_lock(&quiet_lock);
+
+	utc_base = (int64_t)utc - k_uptime_get() / MSEC_PER_SEC;
+	utc_valid = true;
+	k_spin_unlock(&quiet_lock, key);
+
+	quiet_reevaluate();
+}
+
+int quiet_get_time(uint32_t *utc)
+{
+	k_spinlock_key_t key = k_spin_lock(&quiet_lock);
+	const bool valid = utc_valid;
+
+	*utc = (uint32_t)(utc_base + k_uptime_get() / MSEC_PER_SEC);
+	k_spin_unlock(&quiet_lock, key);
+
+	return valid ? 0 : -EAGAIN;
+}
+
+int quiet_init(quiet_handler_t handler)
+{
+	uint16_t start, end;
+	uint32_t utc;
+
+	quiet_get_window(&start, &end);
+	if (start != end && quiet_get_time(&utc) == -EAGAIN) {
+		LOG_INF("Quiet hours suspended until the time is set");
+	}
+
+	quiet_handler = handler;
+	k_work_reschedule_for_queue(&tag_work_q, &quiet_work, K_NO_WAIT);
+	return 0;
+}
@@ -0,0 +1,31 @@
+#ifndef QUIET_H
+#define QUIET_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Daily quiet window. The wall clock is a provisioned UTC time carried on
+ * by the uptime, which the kernel keeps from the RTC, so the window only
+ * applies once a time is known. The time is not stored: after a cold reset
+ * quiet hours are suspended until the config service or a 0xf7 frame sets
+ * it again, rather than running the window off a stale clock. The handler
+ * runs on tag_work_q at every window boundary; nothing wakes up in between.
+ */
+typedef void (*quiet_handler_t)(bool quiet);
+
+/* Minutes after UTC midnight, a window past midnight wraps (e.g. 22:00-06:00) */
+#define QUIET_MINUTES_PER_DAY 1440
+
+/* Start following the window, the handler gets the first state right away */
+int quiet_init(quiet_handler_t handler);
+
+/* start == end disables the window */
+void quiet_set_window(uint16_t start_min, uint16_t end_min);
+void quiet_get_window(uint16_t *start_min, uint16_t *end_min);
+
+/* Current time in Unix seconds, -EAGAIN from quiet_get_time() until one is set */
+void quiet_set_time(uint32_t utc);
+int quiet_get_time(uint32_t *utc);
+
+#endif /* QUIET_H */
@@ -0,0 +1,72 @@
+/* retained.c - Snapshot in RAM kept across warm resets */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/linker/section_tags.h>
+#include <zephyr/drivers/hwinfo.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/logging/log.h>
+
+#include "retained.h"
+
+LOG_MODULE_REGISTER(retained, CONFIG_TAG_LOG_LEVEL);
+
+#define RETAINED_MAGIC 0x54414752
+
+struct retained_area {
+	uint32_t magic;
+	uint32_t len;
+	uint8_t data[RETAINED_DATA_MAX];
+	uint32_t crc;
+};
+
+static __noinit struct retained_area retained;
+
+/* Covers the header too, so a stray magic alone never passes */
+static uint32_t retained_crc(void)
+{
+	return crc32_ieee((const uint8_t *)&retained,
+			  offsetof(struct retained_area, data) + retained.len);
+}
+
+int retained_load(void *data, size_t len)
+{
+	uint32_t cause = 0;
+	const int err = hwinfo_get_reset_cause(&cause);
+	bool valid;
+
+	hwinfo_clear_reset_cause();
+
+	/* RAM contents are undefined after the supply came up */
+	if (err || cause == 0 || (cause & (RESET_POR | RESET_BROWNOUT))) {
+		retained.magic = 0;
+		return -ENOENT;
+	}
+
+	valid = retained.magic == RETAINED_MAGIC && retained.len == len &&
+		retained.crc == retained_crc();
+	retained.magic = 0;
+	if (!valid) {
+		LOG_INF("Warm reset (cause 0x%08x), no snapshot", cause);
+		return -EBADMSG;
+	}
+
+	memcpy(data, retained.data, len);
+	LOG_INF("Warm reset (cause 0x%08x), snapshot restored", cause);
+	return 0;
+}
+
+void retained_save(const void *data, size_t len)
+{
+	__ASSERT_NO_MSG(len <= RETAINED_DATA_MAX);
+
+	retained.magic = RETAINED_MAGIC;
+	retained.len = len;
+	memcpy(retained.data, data, len);
+	retained.crc = retained_crc();
+}
@@ -0,0 +1,25 @@
+#ifndef RETAINED_H
+#define RETAINED_H
+
+#include <stddef.h>
+
+/*
+ * One snapshot in RAM the startup code leaves alone (__noinit), so it
+ * survives watchdog, fault, pin and software resets but not power loss.
+ * A magic, the length and a CRC32 guard it, and it is only handed out
+ * after a warm reset cause.
+ */
+#define RETAINED_DATA_MAX 256
+
+/*
+ * Copy out a snapshot of exactly len bytes: -ENOENT after power-on or
+ * brownout, -EBADMSG when nothing valid was kept. Reads and clears the
+ * reset cause, and drops the snapshot, so one that keeps crashing the tag
+ * is only tried once. Call once at boot.
+ */
+int retained_load(void *data, size_t len);
+
+/* Replace the snapshot, len must not exceed RETAINED_DATA_MAX */
+void retained_save(const void *data, size_t len);
+
+#endif /* RETAINED_H */
@@ -0,0 +1,302 @@
+/* secp160r1.c - Base point multiplication on secp160r1 */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <zephyr/sys/byteorder.h>
+
+#include "secp160r1.h"
+
+#define LIMBS 5
+
+/* Field elements: 5 little-endian 32-bit limbs, always fully reduced */
+typedef uint32_t fe[LIMBS];
+
+/* Jacobian point (X / Z^2, Y / Z^3), Z = 0 is the point at infinity */
+struct jpoint {
+	fe x;
+	fe y;
+	fe z;
+};
+
+/* p = 2^160 - 2^31 - 1, so 2^160 = 2^31 + 1 (mod p) */
+static const fe p = { 0x7fffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff };
+
+static const fe gx = { 0x13cbfc82, 0x68c38bb9, 0x46646989, 0x8ef57328, 0x4a96b568 };
+static const fe gy = { 0x7ac5fb32, 0x04235137, 0x59dcc912, 0x3168947d, 0x23a62855 };
+
+const uint8_t secp160r1_n[SECP160R1_SCALAR_SIZE] = {
+	0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x01, 0xf4, 0xc8, 0xf9, 0x27, 0xae, 0xd3, 0xca, 0x75, 0x22, 0x57,
+};
+
+static bool fe_is_zero(const fe a)
+{
+	uint32_t acc = 0;
+
+	for (int i = 0; i < LIMBS; i++) {
+		acc |= a[i];
+	}
+	return acc == 0;
+}
+
+/* r = a - p if a >= p, for a < 2p */
+static void fe_cond_sub_p(fe a)
+{
+	fe t;
+	int64_t c = 0;
+
+	for (int i = 0; i < LIMBS; i++) {
+		c += (int64_t)a[i] - p[i];
+		t[i] = (uint32_t)c;
+		c >>= 32;
+	}
+	if (c == 0) {
+		memcpy(a, t, sizeof(fe));
+	}
+}
+
+/* a + carry * 2^160, folded back below 2^160 and reduced */
+static void fe_fold(fe a, uint64_t carry)
+{
+	uint64_t v = carry + (carry << 31);
+	uint64_t c = 0;
+
+	for (int i = 0; i < LIMBS; i++) {
+		c += (uint64_t)a[i] + (uint32_t)v;
+		v >>= 32;
+		a[i] = (uint32_t)c;
+		c >>= 32;
+	}
+	/* A second carry leaves a small value, one more fold cannot overflow */
+	if (c) {
+		c = (uint64_t)a[0] + (1ULL << 31) + 1;
+		a[0] = (uint32_t)c;
+		c >>= 32;
+		for (int i = 1; i < LIMBS && c; i++) {
+			c += a[i];
+			a[i] = (uint32_t)c;
+			c >>= 32;
+		}
+	}
+	fe_cond_sub_p(a);
+}
+
+static void fe_add(fe r, const fe a, const fe b)
+{
+	uint64_t c = 0;
+
+	for (int i = 0; i < LIMBS; i++) {
+		c += (uint64_t)a[i] + b[i];
+		r[i] = (uint32_t)c;
+		c >>= 32;
+	}
+	fe_fold(r, c);
+}
+
+static void fe_sub(fe r, const fe a, const fe b)
+{
+	int64_t c = 0;
+
+	for (int i = 0; i < LIMBS; i++) {
+		c += (int64_t)a[i] - b[i];
+		r[i] = (uint32_t)c;
+		c >>= 32;
+	}
+	/* Wrapped below zero: add p back, the carry out cancels the borrow */
+	if (c) {
+		uint64_t d = 0;
+
+		for (int i = 0; i < LIMBS; i++) {
+			d += (uint64_t)r[i] + p[i];
+			r[i] = (uint32_t)d;
+			d >>= 32;
+		}
+	}
+}
+
+static void fe_mul(fe r, const fe a, const fe b)
+{
+	uint32_t t[2 * LIMBS] = { 0 };
+	uint64_t c;
+
+	for (int i = 0; i < LIMBS; i++) {
+		c = 0;
+		for (int j = 0; j < LIMBS; j++) {
+			c += (uint64_t)a[i] * b[j] + t[i + j];
+			t[i + j] = (uint32_t)c;
+			c >>= 32;
+		}
+		t[i + LIMBS] = (uint32_t)c;
+	}
+
+	/* low + high * (2^31 + 1), the high half shifted by 31 straddles limbs */
+	c = 0;
+	for (int i = 0; i < LIMBS; i++) {
+		c += (uint64_t)t[i] + t[i + LIMBS] + (uint32_t)(t[i + LIMBS] << 31);
+		if (i > 0) {
+			c += t[i + LIMBS - 1] >> 1;
+		}
+		r[i] = (uint32_t)c;
+		c >>= 32;
+	}
+	fe_fold(r, c + (t[2 * LIMBS - 1] >> 1));
+}
+
+static void fe_sqr(fe r, const fe a)
+{
+	fe_mul(r, a, a);
+}
+
+/* a^(p - 2), p - 2 = 2^160 - 2^31 - 3 */
+static void fe_inv(fe r, const fe a)
+{
+	static const fe e = { 0x7ffffffd, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff };
+	fe t = { 1 };
+
+	for (int bit = 32 * LIMBS - 1; bit >= 0; bit--) {
+		fe_sqr(t, t);
+		if ((e[bit / 32] >> (bit % 32)) & 1) {
+			fe_mul(t, t, a);
+		}
+	}
+	memcpy(r, t, sizeof(fe));
+}
+
+/* dbl-2001-b for a = -3 */
+static void point_double(struct jpoint *r, const struct jpoint *a)
+{
+	fe delta, gamma, beta, alpha, t1, t2;
+
+	fe_sqr(delta, a->z);
+	fe_sqr(gamma, a->y);
+	fe_mul(beta, a->x, gamma);
+
+	fe_sub(t1, a->x, delta);
+	fe_add(t2, a->x, delta);
+	fe_mul(alpha, t1, t2);
+	fe_add(t1, alpha, alpha);
+	fe_add(alpha, t1, alpha);
+
+	/* Z3 = (Y + Z)^2 - gamma - delta */
+	fe_add(t1, a->y, a->z);
+	fe_sqr(t1, t1);
+	fe_sub(t1, t1, gamma);
+	fe_sub(r->z, t1, delta);
+
+	/* X3 = alpha^2 - 8 beta */
+	fe_add(beta, beta, beta);
+	fe_add(beta, beta, beta);
+	fe_add(t2, beta, beta);
+	fe_sqr(t1, alpha);
+	fe_sub(r->x, t1, t2);
+
+	/* Y3 = alpha (4 beta - X3) - 8 gamma^2 */
+	fe_sub(t1, beta, r->x);
+	fe_mul(t1, alpha, t1);
+	fe_sqr(t2, gamma);
+	fe_add(t2, t2, t2);
+	fe_add(t2, t2, t2);
+	fe_add(t2, t2, t2);
+	fe_sub(r->y, t1, t2);
+}
+
+/* r = a + G, with G affine (Z2 = 1) */
+static void point_add_g(struct jpoint *r, const struct jpoint *a)
+{
+	fe z2, u2, s2, h, rr, h2, h3, t;
+
+	if (fe_is_zero(a->z)) {
+		memcpy(r->x, gx, sizeof(fe));
+		memcpy(r->y, gy, sizeof(fe));
+		memset(r->z, 0, sizeof(fe));
+		r->z[0] = 1;
+		return;
+	}
+
+	fe_sqr(z2, a->z);
+	fe_mul(u2, gx, z2);
+	fe_mul(s2, a->z, z2);
+	fe_mul(s2, gy, s2);
+	fe_sub(h, u2, a->x);
+	fe_sub(rr, s2, a->y);
+
+	if (fe_is_zero(h)) {
+		if (fe_is_zero(rr)) {
+			point_double(r, a);
+		} else {
+			memset(r, 0, sizeof(*r));
+		}
+		return;
+	}
+
+	fe_sqr(h2, h);
+	fe_mul(h3, h2, h);
+	fe_mul(u2, a->x, h2);
+
+	/* X3 = R^2 - H^3 - 2 U1 H^2 */
+	fe_sqr(t, rr);
+	fe_sub(t, t, h3);
+	fe_sub(t, t, u2);
+	fe_sub(t, t, u2);
+
+	/* Y3 = R (U1 H^2 - X3) - S1 H^3 */
+	fe_sub(u2, u2, t);
+	fe_mul(u2, rr, u2);
+	fe_mul(h3, a->y, h3);
+	fe_mul(r->z, a->z, h);
+	fe_sub(r->y, u2, h3);
+	memcpy(r->x, t, sizeof(fe));
+}
+
+static bool scalar_valid(const uint8_t k[SECP160R1_SCALAR_SIZE])
+{
+	uint8_t acc = 0;
+
+	for (int i = 0; i < SECP160R1_SCALAR_SIZE; i++) {
+		acc |= k[i];
+	}
+	if (acc == 0) {
+		return false;
+	}
+	for (int i = 0; i < SECP160R1_SCALAR_SIZE; i++) {
+		if (k[i] != secp160r1_n[i]) {
+			return k[i] < secp160r1_n[i];
+		}
+	}
+	return false;
+}
+
+int secp160r1_mul_base_x(const uint8_t k[SECP160R1_SCALAR_SIZE], uint8_t x[SECP160R1_FIELD_SIZE])
+{
+	struct jpoint acc = { 0 };
+	struct jpoint sum;
+	fe zinv, t;
+
+	if (!scalar_valid(k)) {
+		return -EINVAL;
+	}
+
+	/* Double and always add, keeping the sum only for set bits */
+	for (int bit = 8 * SECP160R1_SCALAR_SIZE - 1; bit >= 0; bit--) {
+		point_double(&acc, &acc);
+		point_add_g(&sum, &acc);
+		if ((k[SECP160R1_SCALAR_SIZE - 1 - bit / 8] >> (bit % 8)) & 1) {
+			acc = sum;
+		}
+	}
+
+	/* k < n, so k * G is never the point at infinity */
+	fe_inv(zinv, acc.z);
+	fe_sqr(t, zinv);
+	fe_mul(t, acc.x, t);
+
+	for (int i = 0; i < LIMBS; i++) {
+		sys_put_be32(t[i], &x[SECP160R1_FIELD_SIZE - 4 * (i + 1)]);
+	}
+	return 0;
+}
@@ -0,0 +1,21 @@
+#ifndef SECP160R1_H
+#define SECP160R1_H
+
+#include <stdint.h>
+
+/* Field elements and x coordinates are 20 bytes, the group order n is 161 bits */
+#define SECP160R1_FIELD_SIZE 20
+#define SECP160R1_SCALAR_SIZE 21
+
+/* Group order n, big-endian */
+extern const uint8_t secp160r1_n[SECP160R1_SCALAR_SIZE];
+
+/*
+ * x coordinate of k * G on secp160r1 (SEC 2), big-endian in and out. No
+ * PSA driver in nrf_security implements this 160-bit curve, so it is done
+ * in software. The ladder runs a fixed number of doublings and additions
+ * for every k. Returns -EINVAL for k = 0 or k >= n.
+ */
+int secp160r1_mul_base_x(const uint8_t k[SECP160R1_SCALAR_SIZE], uint8_t x[SECP160R1_FIELD_SIZE]);
+
+#endif /* SECP160R1_H */
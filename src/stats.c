@@ -0,0 +1,219 @@
+/* stats.c - Radio and lifecycle counters, shell command */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#if defined(CONFIG_SHELL)
+#include <zephyr/shell/shell.h>
+#endif
+
+#include "stats.h"
+
+/* Preamble, access address, header, AdvA and CRC around the AD payload */
+#define ADV_PDU_OVERHEAD 16
+/* Radio ramp-up before each of the three channel transmissions */
+#define ADV_RAMP_UP_US 140
+/* Mean of the 0-10 ms advDelay added to every interval */
+#define ADV_DELAY_MEAN_US 5000
+
+static atomic_t stats[TAG_STAT_COUNT];
+
+/* Advertising time not yet folded into whole events */
+struct adv_account {
+	bool running;
+	int64_t since;
+	uint32_t carry_us;
+	uint32_t period_us;
+	uint32_t airtime_us;
+	uint32_t events;
+};
+
+/* Everything behind the time based counters */
+struct account {
+	struct adv_account adv[2];
+	uint64_t radio_on_us;
+	uint32_t state_ms[TAG_STAT_ROTATING_MS - TAG_STAT_UNPROVISIONED_MS + 1];
+	unsigned int state_current;
+	int64_t state_since;
+};
+
+/*
+ * Published like the keys in main.c: tag_work_q, the only writer, changes
+ * a copy in the idle bank and bumps account_generation to make it live.
+ * Readers copy the live bank and retry if the generation moved meanwhile,
+ * so neither side locks, waits or masks interrupts.
+ */
+static struct account account_banks[2];
+static atomic_t account_generation;
+
+void stats_inc(enum tag_stat stat)
+{
+	atomic_inc(&stats[stat]);
+}
+
+void stats_add(enum tag_stat stat, uint32_t value)
+{
+	atomic_add(&stats[stat], value);
+}
+
+uint32_t stats_get(enum tag_stat stat)
+{
+	return atomic_get(&stats[stat]);
+}
+
+/* Copy of the live bank to change, published by account_commit() */
+static struct account *account_begin(void)
+{
+	const atomic_val_t generation = atomic_get(&account_generation);
+	struct account *next = &account_banks[(generation + 1) & 1];
+
+	*next = account_banks[generation & 1];
+	return next;
+}
+
+static void account_commit(void)
+{
+	atomic_inc(&account_generation);
+}
+
+static void account_snapshot(struct account *account)
+{
+	atomic_val_t generation;
+
+	do {
+		generation = atomic_get(&account_generation);
+		*account = account_banks[generation & 1];
+	} while (atomic_get(&account_generation) != generation);
+}
+
+/* Fold elapsed advertising time into events and radio time */
+static void adv_account_fold(struct account *account, enum tag_stat events, int64_t now)
+{
+	struct adv_account *adv = &account->adv[events - TAG_STAT_ADV_EVENTS_APPLE];
+	uint64_t elapsed_us;
+	uint32_t n;
+
+	if (!adv->running) {
+		return;
+	}
+
+	elapsed_us = (uint64_t)(now - adv->since) * USEC_PER_MSEC + adv->carry_us;
+	n = elapsed_us / adv->period_us;
+	adv->carry_us = elapsed_us % adv->period_us;
+	adv->since = now;
+	adv->events += n;
+	account->radio_on_us += (uint64_t)n * adv->airtime_us;
+}
+
+/* Time in the current state up to now */
+static void state_account_fold(struct account *account, int64_t now)
+{
+	account->state_ms[account->state_current] += now - account->state_since;
+	account->state_since = now;
+}
+
+void stats_adv_start(enum tag_stat events, uint16_t interval_min, const struct bt_data *ad,
+		     size_t ad_len)
+{
+	struct account *account = account_begin();
+	struct adv_account *adv = &account->adv[events - TAG_STAT_ADV_EVENTS_APPLE];
+	uint32_t pdu_bytes = ADV_PDU_OVERHEAD;
+	const int64_t now = k_uptime_get();
+
+	for (size_t i = 0; i < ad_len; i++) {
+		pdu_bytes += 2 + ad[i].data_len;
+	}
+
+	adv_account_fold(account, events, now);
+	if (!adv->running) {
+		adv->running = true;
+		adv->since = now;
+		adv->carry_us = 0;
+	}
+	adv->period_us = interval_min * 625 + ADV_DELAY_MEAN_US;
+	adv->airtime_us = 3 * (pdu_bytes * 8 + ADV_RAMP_UP_US);
+	account_commit();
+}
+
+void stats_adv_stop(enum tag_stat events)
+{
+	struct account *account = account_begin();
+
+	adv_account_fold(account, events, k_uptime_get());
+	account->adv[events - TAG_STAT_ADV_EVENTS_APPLE].running = false;
+	account_commit();
+}
+
+void stats_state_enter(unsigned int state)
+{
+	struct account *account = account_begin();
+
+	state_account_fold(account, k_uptime_get());
+	account->state_current = state;
+	account_commit();
+}
+
+void stats_snapshot(uint32_t values[TAG_STAT_COUNT])
+{
+	struct account account;
+	int64_t now;
+
+	account_snapshot(&account);
+	now = k_uptime_get();
+
+	/* Fold the running time into the private copy only */
+	adv_account_fold(&account, TAG_STAT_ADV_EVENTS_APPLE, now);
+	adv_account_fold(&account, TAG_STAT_ADV_EVENTS_GOOGLE, now);
+	state_account_fold(&account, now);
+
+	for (size_t i = 0; i < TAG_STAT_COUNT; i++) {
+		values[i] = atomic_get(&stats[i]);
+	}
+	values[TAG_STAT_ADV_EVENTS_APPLE] = account.adv[0].events;
+	values[TAG_STAT_ADV_EVENTS_GOOGLE] = account.adv[1].events;
+	values[TAG_STAT_RADIO_ON_MS] = account.radio_on_us / USEC_PER_MSEC;
+	for (size_t i = 0; i < ARRAY_SIZE(account.state_ms); i++) {
+		values[TAG_STAT_UNPROVISIONED_MS + i] = account.state_ms[i];
+	}
+}
+
+#if defined(CONFIG_SHELL)
+static const char *const stat_names[TAG_STAT_COUNT] = {
+	[TAG_STAT_ADV_EVENTS_APPLE] = "adv_events_apple",
+	[TAG_STAT_ADV_EVENTS_GOOGLE] = "adv_events_google",
+	[TAG_STAT_RADIO_ON_MS] = "radio_on_ms",
+	[TAG_STAT_PROTOCOL_SWITCHES] = "protocol_switches",
+	[TAG_STAT_ADV_ERRORS] = "adv_errors",
+	[TAG_STAT_SCAN_SEEN] = "scan_seen",
+	[TAG_STAT_SCAN_ACCEPTED] = "scan_accepted",
+	[TAG_STAT_UNPROVISIONED_MS] = "unprovisioned_ms",
+	[TAG_STAT_PROVISIONING_MS] = "provisioning_ms",
+	[TAG_STAT_BEACONING_MS] = "beaconing_ms",
+	[TAG_STAT_ROTATING_MS] = "rotating_ms",
+	[TAG_STAT_EID_FAILURES] = "eid_failures",
+};
+
+static int cmd_tag_stats(const struct shell *sh, size_t argc, char **argv)
+{
+	uint32_t values[TAG_STAT_COUNT];
+
+	stats_snapshot(values);
+	for (size_t i = 0; i < TAG_STAT_COUNT; i++) {
+		shell_print(sh, "%-18s %u", stat_names[i], values[i]);
+	}
+	shell_print(sh, "%-18s %u", "uptime_ms", k_uptime_get_32());
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(tag_cmds,
+	SHELL_CMD(stats, NULL, "Show radio and lifecycle counters", cmd_tag_stats),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(tag, &tag_cmds, "Hybrid tag commands", NULL);
+#endif
@@ -0,0 +1,56 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/bluetooth/bluetooth.h>
+
+/*
+ * Runtime counters since boot, read with the "tag stats" shell command
+ * and the stats characteristic (TAG_STAT_COUNT little-endian uint32
+ * values in this order). Counters are plain atomics, safe to bump from
+ * any thread or the Bluetooth RX path. The advertising event, radio and
+ * state time values are accounted on tag_work_q and only read through
+ * stats_snapshot(), lock free as well.
+ */
+enum tag_stat {
+    TAG_STAT_ADV_EVENTS_APPLE,  /* Estimated from time on air and interval */
+    TAG_STAT_ADV_EVENTS_GOOGLE,
+    TAG_STAT_RADIO_ON_MS,       /* Estimated TX time of those events */
+    TAG_STAT_PROTOCOL_SWITCHES,
+    TAG_STAT_ADV_ERRORS,        /* Failed advertiser start, stop or update */
+    TAG_STAT_SCAN_SEEN,         /* Provisioning scan reports */
+    TAG_STAT_SCAN_ACCEPTED,     /* ... carrying a provisioning frame */
+    TAG_STAT_UNPROVISIONED_MS,  /* Time per lifecycle state, tag_state_t order */
+    TAG_STAT_PROVISIONING_MS,
+    TAG_STAT_BEACONING_MS,
+    TAG_STAT_ROTATING_MS,
+    TAG_STAT_EID_FAILURES,      /* EID not computed, old or static EID kept */
+    TAG_STAT_COUNT,
+};
+
+void stats_inc(enum tag_stat stat);
+void stats_add(enum tag_stat stat, uint32_t value);
+uint32_t stats_get(enum tag_stat stat);
+
+/*
+ * Advertising events are not visible to the host, so they are estimated:
+ * the minimum interval, which is what the controller runs (the Zephyr
+ * controller ignores the maximum), plus the 5 ms mean advDelay, and each
+ * event sends the PDU on all three primary channels. The bsim schedule
+ * suite checks the estimate against the PDUs a second device receives.
+ * events is TAG_STAT_ADV_EVENTS_APPLE or TAG_STAT_ADV_EVENTS_GOOGLE.
+ * Starting again with new parameters first accounts for the time run
+ * with the old ones.
+ */
+void stats_adv_start(enum tag_stat events, uint16_t interval_min, const struct bt_data *ad,
+		     size_t ad_len);
+void stats_adv_stop(enum tag_stat events);
+
+/* Account the time spent in the previous lifecycle state (tag_state_t value) */
+void stats_state_enter(unsigned int state);
+
+/* Current values, including time in the running state and advertisers */
+void stats_snapshot(uint32_t values[TAG_STAT_COUNT]);
+
+#endif /* STATS_H */
@@ -0,0 +1,13 @@
+#ifndef TAG_WORK_H
+#define TAG_WORK_H
+
+#include <zephyr/kernel.h>
+
+/*
+ * Low-priority workqueue for the tag lifecycle (provisioning, beaconing,
+ * rotation) and flash work, so none of it competes with Bluetooth host
+ * work on the system workqueue. Started from main().
+ */
+extern struct k_work_q tag_work_q;
+
+#endif /* TAG_WORK_H */
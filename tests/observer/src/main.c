@@ -0,0 +1,136 @@
+/* main.c - Scanning peer of the schedule suite: counts the tag's advertising events */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/gap.h>
+#include <zephyr/logging/log.h>
+
+#include "bs_types.h"
+#include "bs_pc_backchannel.h"
+#include "bsim_args_runner.h"
+
+#include "adv_frames.h"
+#include "observer.h"
+
+LOG_MODULE_REGISTER(observer, LOG_LEVEL_INF);
+
+/* Index into the report fields, protocol_t order */
+enum {
+	OBSERVED_APPLE,
+	OBSERVED_GOOGLE,
+};
+
+/* Report in progress */
+static struct observer_report report;
+static int64_t first_us[2];
+static struct k_spinlock report_lock;
+
+/* Last PDU per protocol, kept across reports so a switch at a request still counts */
+static int64_t last_us[2];
+static int last_protocol = -1;
+
+static bool frame_found(struct bt_data *data, void *user_data)
+{
+	int *protocol = user_data;
+
+	if (data->type == BT_DATA_MANUFACTURER_DATA && data->data_len == APPLE_FINDMY_PAYLOAD_SIZE &&
+	    data->data[0] == 0x4c && data->data[1] == 0x00 &&
+	    data->data[2] == APPLE_FINDMY_TYPE_OFFLINE_FINDING) {
+		*protocol = OBSERVED_APPLE;
+		return false;
+	}
+	if (data->type == BT_DATA_SVC_DATA16 && data->data_len == GOOGLE_FMDN_PAYLOAD_SIZE &&
+	    data->data[0] == 0xaa && data->data[1] == 0xfe &&
+	    data->data[2] == GOOGLE_FMDN_TYPE_FHN) {
+		*protocol = OBSERVED_GOOGLE;
+		return false;
+	}
+	return true;
+}
+
+static void scan_cb(const bt_addr_le_t *addr, int8_t rssi, uint8_t type, struct net_buf_simple *ad)
+{
+	const int64_t now = k_ticks_to_us_floor64(k_uptime_ticks());
+	int protocol = -1;
+	k_spinlock_key_t key;
+
+	bt_data_parse(ad, frame_found, &protocol);
+	if (protocol < 0) {
+		return;
+	}
+
+	key = k_spin_lock(&report_lock);
+	if (report.events[protocol]++ == 0) {
+		first_us[protocol] = now;
+	}
+	report.span_us[protocol] = now - first_us[protocol];
+
+	if (last_protocol >= 0 && protocol != last_protocol) {
+		report.switches++;
+		report.max_switch_gap_us = MAX(report.max_switch_gap_us,
+					       (uint32_t)(now - last_us[last_protocol]));
+	}
+	last_protocol = protocol;
+	last_us[protocol] = now;
+	k_spin_unlock(&report_lock, key);
+}
+
+int main(void)
+{
+	const struct bt_le_scan_param scan_param = {
+		.type = BT_LE_SCAN_TYPE_PASSIVE,
+		.options = BT_LE_SCAN_OPT_NONE,
+		.interval = OBSERVER_SCAN_INTERVAL,
+		.window = OBSERVER_SCAN_INTERVAL,
+	};
+	uint tag_device = OBSERVER_TAG_DEVICE;
+	uint channel = OBSERVER_CHANNEL;
+	uint *back_channel;
+	int err;
+
+	back_channel = bs_open_back_channel(get_device_nbr(), &tag_device, &channel, 1);
+	if (!back_channel) {
+		LOG_ERR("Failed to open the back channel to the tag");
+		return -EIO;
+	}
+
+	err = bt_enable(NULL);
+	if (err) {
+		LOG_ERR("Bluetooth init failed (err %d)", err);
+		return err;
+	}
+
+	err = bt_le_scan_start(&scan_param, scan_cb);
+	if (err) {
+		LOG_ERR("Scanning failed to start (err %d)", err);
+		return err;
+	}
+	LOG_INF("Observing");
+
+	/* Answer each request with the report so far and start a new one */
+	while (true) {
+		struct observer_report sent;
+		uint8_t request;
+		k_spinlock_key_t key;
+
+		if (bs_bc_is_msg_received(back_channel[0]) <= 0) {
+			k_sleep(K_MSEC(1));
+			continue;
+		}
+		bs_bc_receive_msg(back_channel[0], &request, sizeof(request));
+
+		key = k_spin_lock(&report_lock);
+		sent = report;
+		memset(&report, 0, sizeof(report));
+		k_spin_unlock(&report_lock, key);
+
+		bs_bc_send_msg(back_channel[0], (uint8_t *)&sent, sizeof(sent));
+	}
+	return 0;
+}
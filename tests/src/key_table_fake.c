@@ -0,0 +1,60 @@
+/* key_table_fake.c - RAM key table and upload channel for the schedule suite */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+#include <zephyr/kernel.h>
+
+#include "key_table.h"
+#include "key_upload.h"
+#include "key_table_fake.h"
+
+static uint8_t fake_keys[KEY_TABLE_FAKE_COUNT][KEY_TABLE_KEY_SIZE];
+static bool fake_table_valid;
+static uint32_t key_count;
+static key_upload_handler_t upload_handler;
+
+int key_table_init(void)
+{
+	key_count = fake_table_valid ? KEY_TABLE_FAKE_COUNT : 0;
+	return fake_table_valid ? (int)key_count : -ENOENT;
+}
+
+uint32_t key_table_count(void)
+{
+	return key_count;
+}
+
+const uint8_t *key_table_get(uint32_t index)
+{
+	if (index >= key_count) {
+		return NULL;
+	}
+	return fake_keys[index];
+}
+
+int key_upload_init(key_upload_handler_t handler)
+{
+	upload_handler = handler;
+	return 0;
+}
+
+void key_table_fake_upload_start(void)
+{
+	upload_handler(false);
+	fake_table_valid = false;
+	memset(fake_keys, 0xff, sizeof(fake_keys));
+	key_table_init();
+}
+
+void key_table_fake_upload_commit(void)
+{
+	for (int i = 0; i < KEY_TABLE_FAKE_COUNT; i++) {
+		memset(fake_keys[i], 0xa0 + i, KEY_TABLE_KEY_SIZE);
+	}
+	fake_table_valid = true;
+	key_table_init();
+	upload_handler(true);
+}
@@ -0,0 +1,20 @@
+#ifndef KEY_TABLE_FAKE_H
+#define KEY_TABLE_FAKE_H
+
+#include <stdint.h>
+
+/*
+ * Simulation has no memory-mapped flash, so key_table_fake.c implements
+ * key_table.h over RAM and key_upload_init() only keeps the handler. The
+ * two calls below stand in for an upload and report to the handler just
+ * as key_upload.c does. Call them on tag_work_q.
+ */
+#define KEY_TABLE_FAKE_COUNT 4
+
+/* START: report the table gone, then erase it */
+void key_table_fake_upload_start(void);
+
+/* COMMIT: KEY_TABLE_FAKE_COUNT keys, each filled with 0xa0 + its slot, then report it */
+void key_table_fake_upload_commit(void);
+
+#endif /* KEY_TABLE_FAKE_H */
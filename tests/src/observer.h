@@ -0,0 +1,32 @@
+#ifndef OBSERVER_H
+#define OBSERVER_H
+
+#include <stdint.h>
+
+/*
+ * On nrf52_bsim a second device (tests/observer) scans the tag and counts
+ * the advertising PDUs it receives per protocol, Apple FindMy by its
+ * manufacturer data and Google FMDN by its service data. It scans with
+ * the window as long as the interval, so every advertising event is
+ * received once, on the channel the scanner listens on.
+ *
+ * The schedule suite sends one byte on the BabbleSim back channel and the
+ * observer answers with an observer_report covering the time since the
+ * previous request, then starts over. The switch fields only mean
+ * something with the single legacy advertiser.
+ */
+#define OBSERVER_TAG_DEVICE 0
+#define OBSERVER_DEVICE 1
+#define OBSERVER_CHANNEL 0
+
+/* Scan interval and window, 1 s so channel changes hardly ever cut an event */
+#define OBSERVER_SCAN_INTERVAL 0x0640
+
+struct observer_report {
+	uint32_t events[2];        /* PDUs received, protocol_t order */
+	uint32_t span_us[2];       /* First to last of those PDUs */
+	uint32_t switches;         /* PDUs of one protocol following the other */
+	uint32_t max_switch_gap_us; /* Longest time off air across one of those */
+};
+
+#endif /* OBSERVER_H */
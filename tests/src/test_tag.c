@@ -0,0 +1,911 @@
+/* test_tag.c - Payload, scan frame and advertising schedule tests */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/ztest.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys_clock.h>
+#include <zephyr/bluetooth/bluetooth.h>
+
+#if defined(CONFIG_BOARD_NRF52_BSIM)
+#include "bs_types.h"
+#include "bs_pc_backchannel.h"
+#include "bsim_args_runner.h"
+
+#include "observer.h"
+#endif
+#if defined(CONFIG_TAG_KEY_UPLOAD)
+#include "key_table_fake.h"
+#endif
+
+/*
+ * The application is built into this file so the tests reach its static
+ * state and functions. Its main() becomes tag_main(), started by the
+ * schedule suite, and its advertiser calls go through the recording
+ * wrappers below. bluetooth.h is already in, so only the calls are renamed.
+ */
+static int test_adv_start(const struct bt_le_adv_param *param, const struct bt_data *ad,
+			  size_t ad_len, const struct bt_data *sd, size_t sd_len);
+static int test_adv_stop(void);
+
+#define main tag_main
+#define bt_le_adv_start test_adv_start
+#define bt_le_adv_stop test_adv_stop
+
+#if !defined(CONFIG_TAG_EXT_ADV)
+/* Only the legacy protocol switcher swaps data in place */
+static int test_adv_update_data(const struct bt_data *ad, size_t ad_len,
+				const struct bt_data *sd, size_t sd_len);
+
+#define bt_le_adv_update_data test_adv_update_data
+#endif
+
+#if defined(CONFIG_TAG_EXT_ADV)
+static int test_ext_adv_start(struct bt_le_ext_adv *adv,
+			      const struct bt_le_ext_adv_start_param *param);
+static int test_ext_adv_stop(struct bt_le_ext_adv *adv);
+static int test_ext_adv_update_param(struct bt_le_ext_adv *adv,
+				     const struct bt_le_adv_param *param);
+
+#define bt_le_ext_adv_start test_ext_adv_start
+#define bt_le_ext_adv_stop test_ext_adv_stop
+#define bt_le_ext_adv_update_param test_ext_adv_update_param
+#endif
+
+#include "../../src/main.c"
+#undef main
+#undef bt_le_adv_start
+#undef bt_le_adv_stop
+#if defined(CONFIG_TAG_EXT_ADV)
+#undef bt_le_ext_adv_start
+#undef bt_le_ext_adv_stop
+#undef bt_le_ext_adv_update_param
+#else
+#undef bt_le_adv_update_data
+#endif
+
+/* Regression bounds for the schedule suite, in simulated time */
+#define FIRST_BEACON_MAX_US (100 * USEC_PER_MSEC)
+#define RESTART_GAP_MAX_US (5 * USEC_PER_MSEC)
+#define SLOT_JITTER_US (10 * USEC_PER_MSEC)
+/* On air, a switch costs at most one event of the outgoing protocol, its advDelay and a restart */
+#define SWITCH_AIR_GAP_MAX_US(interval) \
+	((interval) * 625 + 10 * USEC_PER_MSEC + RESTART_GAP_MAX_US)
+#define EVENT_TOLERANCE(events) MAX((events) / 20, 2)
+#if defined(CONFIG_TAG_EXT_ADV)
+#define SWITCH_TIMEOUT K_SECONDS(1)
+#define EVENT_WINDOW K_SECONDS(8)
+#else
+#define SWITCH_TIMEOUT K_SECONDS(MAX(CONFIG_TAG_APPLE_SLOT_SEC, CONFIG_TAG_GOOGLE_SLOT_SEC) + 1)
+#define EVENT_CYCLES 2
+#endif
+
+static const uint8_t test_apple_key[APPLE_KEY_SIZE] = {
+	0xd5, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d,
+	0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b,
+};
+
+static const uint8_t test_google_key[GOOGLE_KEY_SIZE] = {
+	0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9,
+	0xaa, 0xab, 0xac, 0xad, 0xae, 0xaf, 0xb0, 0xb1, 0xb2, 0xb3,
+};
+
+static const uint8_t test_device_id[DEVICE_ID_SIZE] = { 0x12, 0x34, 0x56, 0x78 };
+static const uint8_t other_device_id[DEVICE_ID_SIZE] = { 0x12, 0x34, 0x56, 0x79 };
+
+enum adv_call {
+	ADV_CALL_START,
+	ADV_CALL_UPDATE,
+	ADV_CALL_STOP,
+	ADV_CALL_PARAM,
+};
+
+/* One advertiser call that succeeded, protocol -1 for anything but a beacon */
+struct adv_event {
+	enum adv_call call;
+	int protocol;
+	int64_t at_us;
+	uint16_t interval_min; /* New interval of a start or parameter update */
+};
+
+K_MSGQ_DEFINE(adv_events, sizeof(struct adv_event), 64, 4);
+
+static int ad_protocol(const struct bt_data *ad)
+{
+	if (ad == apple_ad) {
+		return PROTOCOL_APPLE_FINDMY;
+	}
+	if (ad == google_ad[0] || ad == google_ad[1]) {
+		return PROTOCOL_GOOGLE_FMDN;
+	}
+	return -1;
+}
+
+static void record_adv_call(enum adv_call call, int protocol, uint16_t interval_min)
+{
+	const struct adv_event event = {
+		.call = call,
+		.protocol = protocol,
+		.at_us = k_ticks_to_us_floor64(k_uptime_ticks()),
+		.interval_min = interval_min,
+	};
+
+	(void)k_msgq_put(&adv_events, &event, K_NO_WAIT);
+}
+
+static int test_adv_start(const struct bt_le_adv_param *param, const struct bt_data *ad,
+			  size_t ad_len, const struct bt_data *sd, size_t sd_len)
+{
+	const int err = bt_le_adv_start(param, ad, ad_len, sd, sd_len);
+
+	if (!err) {
+		record_adv_call(ADV_CALL_START, ad_protocol(ad), param->interval_min);
+	}
+	return err;
+}
+
+#if !defined(CONFIG_TAG_EXT_ADV)
+static int test_adv_update_data(const struct bt_data *ad, size_t ad_len,
+				const struct bt_data *sd, size_t sd_len)
+{
+	const int err = bt_le_adv_update_data(ad, ad_len, sd, sd_len);
+
+	if (!err) {
+		record_adv_call(ADV_CALL_UPDATE, ad_protocol(ad), 0);
+	}
+	return err;
+}
+#endif
+
+static int test_adv_stop(void)
+{
+	const int err = bt_le_adv_stop();
+
+	if (!err) {
+		record_adv_call(ADV_CALL_STOP, -1, 0);
+	}
+	return err;
+}
+
+#if defined(CONFIG_TAG_EXT_ADV)
+/* With one set per protocol the set tells the protocol */
+static int set_protocol(const struct bt_le_ext_adv *adv)
+{
+	if (adv != NULL && adv == apple_adv) {
+		return PROTOCOL_APPLE_FINDMY;
+	}
+	if (adv != NULL && adv == google_adv) {
+		return PROTOCOL_GOOGLE_FMDN;
+	}
+	return -1;
+}
+
+static int test_ext_adv_start(struct bt_le_ext_adv *adv,
+			      const struct bt_le_ext_adv_start_param *param)
+{
+	const int err = bt_le_ext_adv_start(adv, param);
+
+	if (!err) {
+		record_adv_call(ADV_CALL_START, set_protocol(adv), 0);
+	}
+	return err;
+}
+
+static int test_ext_adv_stop(struct bt_le_ext_adv *adv)
+{
+	const int err = bt_le_ext_adv_stop(adv);
+
+	if (!err) {
+		record_adv_call(ADV_CALL_STOP, -1, 0);
+	}
+	return err;
+}
+
+static int test_ext_adv_update_param(struct bt_le_ext_adv *adv,
+				     const struct bt_le_adv_param *param)
+{
+	const int err = bt_le_ext_adv_update_param(adv, param);
+
+	if (!err) {
+		record_adv_call(ADV_CALL_PARAM, set_protocol(adv), param->interval_min);
+	}
+	return err;
+}
+#endif
+
+/* Advertising data as the controller sends it: length, type and data per structure */
+static size_t ad_bytes(const struct bt_data *ad, size_t ad_len, uint8_t *buf)
+{
+	size_t n = 0;
+
+	for (size_t i = 0; i < ad_len; i++) {
+		buf[n++] = ad[i].data_len + 1;
+		buf[n++] = ad[i].type;
+		memcpy(&buf[n], ad[i].data, ad[i].data_len);
+		n += ad[i].data_len;
+	}
+	return n;
+}
+
+/* A provisioning frame in one manufacturer data structure, id NULL for broadcast */
+static size_t frame_ad(uint8_t *buf, uint8_t type, const uint8_t *id, const uint8_t *payload,
+		       uint8_t len)
+{
+	size_t n = 0;
+
+	buf[n++] = 3 + (id ? DEVICE_ID_SIZE : 0) + len;
+	buf[n++] = BT_DATA_MANUFACTURER_DATA;
+	buf[n++] = type;
+	buf[n++] = 0xff;
+	if (id) {
+		memcpy(&buf[n], id, DEVICE_ID_SIZE);
+		n += DEVICE_ID_SIZE;
+	}
+	memcpy(&buf[n], payload, len);
+	return n + len;
+}
+
+static bool report_accepted(const uint8_t *data, size_t len)
+{
+	struct net_buf_simple ad;
+
+	net_buf_simple_init_with_data(&ad, (void *)data, len);
+	return has_provisioning_frame(&ad);
+}
+
+/* Feed one scan report through scan_cb(), as the Bluetooth RX thread would */
+static void scan_report(uint8_t *data, size_t len)
+{
+	struct net_buf_simple ad;
+
+	net_buf_simple_init_with_data(&ad, data, len);
+	scan_cb(NULL, -50, BT_GAP_ADV_TYPE_ADV_NONCONN_IND, &ad);
+}
+
+static void scan_frame(uint8_t type, const uint8_t *id, const uint8_t *payload, uint8_t len)
+{
+	uint8_t report[BT_GAP_ADV_MAX_ADV_DATA_LEN];
+
+	scan_report(report, frame_ad(report, type, id, payload, len));
+}
+
+/* Forget every staged and committed key, as on a fresh tag */
+static void reset_keys(void)
+{
+	atomic_clear(&key_staged);
+	atomic_clear(&keys_generation);
+	memset(&key_staging, 0, sizeof(key_staging));
+	memset(key_banks, 0, sizeof(key_banks));
+}
+
+/* Payload builders: the exact bytes each protocol puts on air */
+
+static void payload_before(void *fixture)
+{
+	memcpy(beacon_keys.apple, test_apple_key, APPLE_KEY_SIZE);
+	memcpy(beacon_keys.google, test_google_key, GOOGLE_KEY_SIZE);
+	apple_key_active = beacon_keys.apple;
+	google_payload_idx = 0;
+	battery_level = BATTERY_LEVEL_UNKNOWN;
+}
+
+ZTEST(tag_payload, test_apple_findmy_bytes)
+{
+	static const uint8_t expected[BT_GAP_ADV_MAX_ADV_DATA_LEN] = {
+		0x1e, 0xff,             /* Manufacturer data, whole legacy payload */
+		0x4c, 0x00, 0x12, 0x19, /* Apple, offline finding, 25 bytes follow */
+		0x00,                   /* Status, battery unknown */
+		0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10,
+		0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b,
+		0x03,                   /* Key byte 0 bits 6-7 */
+		0x00,                   /* Hint */
+	};
+	uint8_t ad[BT_GAP_ADV_MAX_ADV_DATA_LEN];
+
+	prepare_adv_payloads();
+
+	zassert_equal(ad_bytes(apple_ad, ARRAY_SIZE(apple_ad), ad), sizeof(expected));
+	zassert_mem_equal(ad, expected, sizeof(expected));
+}
+
+ZTEST(tag_payload, test_google_fmdn_bytes)
+{
+	static const uint8_t expected[] = {
+		0x02, 0x01, 0x06,       /* Flags, general discoverable, no BR/EDR */
+		0x19, 0x16,             /* 16-bit service data */
+		0xaa, 0xfe, 0x40,       /* Eddystone, FMDN frame */
+		0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9,
+		0xaa, 0xab, 0xac, 0xad, 0xae, 0xaf, 0xb0, 0xb1, 0xb2, 0xb3,
+		0x00,                   /* Flags, battery not reported */
+	};
+	uint8_t ad[BT_GAP_ADV_MAX_ADV_DATA_LEN];
+
+	prepare_adv_payloads();
+
+	zassert_equal(ad_bytes(google_ad[0], ARRAY_SIZE(google_ad[0]), ad), sizeof(expected));
+	zassert_mem_equal(ad, expected, sizeof(expected));
+}
+
+ZTEST(tag_payload, test_google_payload_buffer)
+{
+	static const uint8_t zero[GOOGLE_KEY_SIZE];
+
+	memset(google_fmdn_payload[0].eid, 0, sizeof(google_fmdn_payload[0].eid));
+	google_payload_idx = 1;
+
+	prepare_adv_payloads();
+
+	zassert_mem_equal(google_fmdn_payload[1].eid, test_google_key, GOOGLE_KEY_SIZE);
+	zassert_mem_equal(google_fmdn_payload[0].eid, zero, GOOGLE_KEY_SIZE,
+			  "Payload on air was written");
+}
+
+ZTEST(tag_payload, test_battery_bits)
+{
+	static const struct {
+		enum battery_level level;
+		uint8_t apple_status;
+		uint8_t google_flags;
+	} cases[] = {
+		{ BATTERY_LEVEL_UNKNOWN, 0x00, 0x00 },
+		{ BATTERY_LEVEL_FULL, 0x00, 0x20 },
+		{ BATTERY_LEVEL_MEDIUM, 0x40, 0x20 },
+		{ BATTERY_LEVEL_LOW, 0x80, 0x40 },
+		{ BATTERY_LEVEL_CRITICAL, 0xc0, 0x60 },
+	};
+
+	for (size_t i = 0; i < ARRAY_SIZE(cases); i++) {
+		battery_level = cases[i].level;
+		prepare_adv_payloads();
+
+		zassert_equal(apple_findmy_payload.status, cases[i].apple_status, "Level %d",
+			      cases[i].level);
+		zassert_equal(google_fmdn_payload[0].flags, cases[i].google_flags, "Level %d",
+			      cases[i].level);
+		zassert_equal(google_fmdn_payload[1].flags, cases[i].google_flags, "Level %d",
+			      cases[i].level);
+	}
+}
+
+ZTEST_SUITE(tag_payload, NULL, NULL, payload_before, NULL, NULL);
+
+/* Scan provisioning: the report filter and the frame parser behind it */
+
+static void frames_before(void *fixture)
+{
+	reset_keys();
+	memcpy(device_id, test_device_id, DEVICE_ID_SIZE);
+	adv_profile = CONFIG_TAG_ADV_PROFILE_DEFAULT;
+}
+
+static void frames_after(void *fixture)
+{
+	/* tag_work_q is not running yet, nothing may be left behind for it */
+	k_work_cancel_delayable(&start_advertising_work);
+	reset_keys();
+	adv_profile = CONFIG_TAG_ADV_PROFILE_DEFAULT;
+}
+
+ZTEST(tag_scan_frames, test_filter_accepts)
+{
+	uint8_t report[BT_GAP_ADV_MAX_ADV_DATA_LEN];
+	const uint8_t payload[8] = { 0 };
+
+	for (uint8_t type = 0xf1; type <= 0xf7; type++) {
+		zassert_true(report_accepted(report, frame_ad(report, type, NULL, payload, 8)),
+			     "Frame 0x%02x", type);
+	}
+	for (uint8_t type = 0xe1; type <= 0xe7; type++) {
+		zassert_true(report_accepted(report,
+					     frame_ad(report, type, test_device_id, payload, 8)),
+			     "Frame 0x%02x", type);
+	}
+}
+
+ZTEST(tag_scan_frames, test_filter_accepts_behind_other_data)
+{
+	uint8_t report[BT_GAP_ADV_MAX_ADV_DATA_LEN] = {
+		0x02, BT_DATA_FLAGS, BT_LE_AD_NO_BREDR,
+		0x04, BT_DATA_NAME_COMPLETE, 'S', 'T', 'A',
+	};
+	const uint8_t payload[8] = { 0 };
+
+	zassert_true(report_accepted(report, 8 + frame_ad(&report[8], 0xf2, NULL, payload, 8)));
+}
+
+ZTEST(tag_scan_frames, test_filter_rejects)
+{
+	uint8_t report[BT_GAP_ADV_MAX_ADV_DATA_LEN];
+	const uint8_t payload[8] = { 0 };
+	size_t len;
+
+	/* Outside the 0xFFF1-0xFFF7 and 0xFFE1-0xFFE7 company IDs */
+	zassert_false(report_accepted(report, frame_ad(report, 0xf0, NULL, payload, 8)));
+	zassert_false(report_accepted(report, frame_ad(report, 0xf8, NULL, payload, 8)));
+	zassert_false(report_accepted(report, frame_ad(report, 0xe8, test_device_id, payload, 8)));
+
+	/* Apple manufacturer data */
+	len = frame_ad(report, 0x4c, NULL, payload, 8);
+	report[3] = 0x00;
+	zassert_false(report_accepted(report, len));
+
+	/* Not manufacturer data */
+	len = frame_ad(report, 0xf1, NULL, payload, 8);
+	report[1] = BT_DATA_SVC_DATA16;
+	zassert_false(report_accepted(report, len));
+
+	/* Addressed to another tag, or too short to carry an ID */
+	zassert_false(report_accepted(report,
+				      frame_ad(report, 0xe1, other_device_id, payload, 8)));
+	zassert_false(report_accepted(report, frame_ad(report, 0xe1, NULL, payload, 2)));
+
+	/* Structure running past the end of the report */
+	len = frame_ad(report, 0xf1, NULL, payload, 8);
+	zassert_false(report_accepted(report, len - 1));
+
+	/* Nothing is read after the zero length terminator */
+	report[0] = 0x00;
+	len = 1 + frame_ad(&report[1], 0xf1, NULL, payload, 8);
+	zassert_false(report_accepted(report, len));
+}
+
+ZTEST(tag_scan_frames, test_key_frames_commit)
+{
+	const uint32_t accepted = stats_get(TAG_STAT_SCAN_ACCEPTED);
+	struct tag_keys keys;
+
+	scan_frame(0xf1, NULL, test_apple_key, 20);
+	scan_frame(0xf2, NULL, &test_apple_key[20], 8);
+	zassert_false(keys_received(), "Committed without the Google key");
+
+	scan_frame(0xf3, NULL, test_google_key, GOOGLE_KEY_SIZE);
+	zassert_true(keys_received());
+	zassert_equal(atomic_get(&key_staged), 0, "Staging not started over");
+	zassert_equal(stats_get(TAG_STAT_SCAN_ACCEPTED) - accepted, 3);
+
+	keys_snapshot(&keys);
+	zassert_mem_equal(keys.apple, test_apple_key, APPLE_KEY_SIZE);
+	zassert_mem_equal(keys.google, test_google_key, GOOGLE_KEY_SIZE);
+}
+
+ZTEST(tag_scan_frames, test_addressed_frames_commit)
+{
+	struct tag_keys keys;
+
+	scan_frame(0xe1, other_device_id, test_google_key, 20);
+	zassert_equal(atomic_get(&key_staged), 0, "Took a frame for another tag");
+
+	scan_frame(0xe1, test_device_id, test_apple_key, 20);
+	scan_frame(0xe2, test_device_id, &test_apple_key[20], 8);
+	scan_frame(0xe3, test_device_id, test_google_key, GOOGLE_KEY_SIZE);
+	zassert_true(keys_received());
+
+	keys_snapshot(&keys);
+	zassert_mem_equal(keys.apple, test_apple_key, APPLE_KEY_SIZE);
+	zassert_mem_equal(keys.google, test_google_key, GOOGLE_KEY_SIZE);
+}
+
+ZTEST(tag_scan_frames, test_wrong_length_rejected)
+{
+	scan_frame(0xf1, NULL, test_apple_key, 19);
+	scan_frame(0xf1, NULL, test_apple_key, 21);
+	scan_frame(0xf2, NULL, &test_apple_key[20], 7);
+	scan_frame(0xf3, NULL, test_google_key, GOOGLE_KEY_SIZE + 1);
+	zassert_equal(atomic_get(&key_staged), 0);
+}
+
+ZTEST(tag_scan_frames, test_repeated_frame_ignored)
+{
+	uint8_t other[20];
+
+	memset(other, 0xee, sizeof(other));
+	scan_frame(0xf1, NULL, test_apple_key, 20);
+	scan_frame(0xf1, NULL, other, 20);
+	zassert_mem_equal(key_staging.apple, test_apple_key, 20, "Repeat replaced the first part");
+}
+
+ZTEST(tag_scan_frames, test_frames_after_commit_dropped)
+{
+	uint8_t other[20];
+	struct tag_keys keys;
+
+	scan_frame(0xf1, NULL, test_apple_key, 20);
+	scan_frame(0xf2, NULL, &test_apple_key[20], 8);
+	scan_frame(0xf3, NULL, test_google_key, GOOGLE_KEY_SIZE);
+	zassert_true(keys_received());
+
+	memset(other, 0xee, sizeof(other));
+	scan_frame(0xf1, NULL, other, 20);
+	zassert_equal(atomic_get(&key_staged), 0, "Frame in flight staged again");
+
+	keys_snapshot(&keys);
+	zassert_mem_equal(keys.apple, test_apple_key, APPLE_KEY_SIZE);
+}
+
+ZTEST(tag_scan_frames, test_profile_frame)
+{
+	const uint8_t invalid = ADV_PROFILE_COUNT;
+	const uint8_t balanced = ADV_PROFILE_BALANCED;
+
+	scan_frame(0xf6, NULL, &invalid, 1);
+	zassert_equal(adv_profile, CONFIG_TAG_ADV_PROFILE_DEFAULT);
+
+	scan_frame(0xf6, NULL, &balanced, 1);
+	zassert_equal(adv_profile, ADV_PROFILE_BALANCED);
+}
+
+ZTEST_SUITE(tag_scan_frames, NULL, NULL, frames_before, frames_after, NULL);
+
+#if defined(CONFIG_BOARD_NRF52_BSIM)
+/*
+ * Advertising schedule: the tag runs for real, provisioned over scan
+ * frames. Needs a controller, so only nrf52_bsim runs it, with the
+ * simulated timing that makes the bounds repeatable. The observer device
+ * (observer.h) counts what actually goes on air.
+ */
+
+/* One protocol switch as seen at the advertiser */
+struct adv_switch {
+	int protocol;
+	int64_t at_us;   /* New payload handed to the controller */
+	bool restarted;  /* Stopped and started again instead of swapped in place */
+	int64_t gap_us;  /* Off air before that, 0 for an in-place swap */
+};
+
+static bool next_switch(struct adv_switch *sw, k_timeout_t timeout)
+{
+	int64_t stopped_at = -1;
+	struct adv_event event;
+
+	while (k_msgq_get(&adv_events, &event, timeout) == 0) {
+		if (event.call == ADV_CALL_STOP) {
+			if (stopped_at < 0) {
+				stopped_at = event.at_us;
+			}
+			continue;
+		}
+		if (event.protocol < 0 || event.call == ADV_CALL_PARAM) {
+			continue;
+		}
+		sw->protocol = event.protocol;
+		sw->at_us = event.at_us;
+		sw->restarted = (event.call == ADV_CALL_START);
+		sw->gap_us = stopped_at < 0 ? 0 : event.at_us - stopped_at;
+		return true;
+	}
+	return false;
+}
+
+static bool wait_for_state(tag_state_t state, k_timeout_t timeout)
+{
+	const k_timepoint_t end = sys_timepoint_calc(timeout);
+
+	while (tag_state != state) {
+		if (sys_timepoint_expired(end)) {
+			return false;
+		}
+		k_sleep(K_MSEC(10));
+	}
+	return true;
+}
+
+/* Measured once while the suite brings the tag up */
+static int64_t provisioned_at_us;
+static struct adv_switch first_beacon;
+static uint *observer_channel;
+
+/* Report of the PDUs the observer received since the previous call */
+static bool observer_read(struct observer_report *report)
+{
+	uint8_t request = 0;
+
+	bs_bc_send_msg(observer_channel[0], &request, sizeof(request));
+	for (int i = 0; i < MSEC_PER_SEC; i++) {
+		if (bs_bc_is_msg_received(observer_channel[0]) >= (int)sizeof(*report)) {
+			bs_bc_receive_msg(observer_channel[0], (uint8_t *)report, sizeof(*report));
+			return true;
+		}
+		k_sleep(K_MSEC(1));
+	}
+	return false;
+}
+
+/* The stats estimate against the events the observer received over the same time */
+static void assert_events(const uint32_t *before, const uint32_t *after,
+			  const struct observer_report *report)
+{
+	static const enum tag_stat stat[] = {
+		[PROTOCOL_APPLE_FINDMY] = TAG_STAT_ADV_EVENTS_APPLE,
+		[PROTOCOL_GOOGLE_FMDN] = TAG_STAT_ADV_EVENTS_GOOGLE,
+	};
+
+	for (int protocol = 0; protocol < ARRAY_SIZE(stat); protocol++) {
+		const int32_t estimated = after[stat[protocol]] - before[stat[protocol]];
+		const int32_t received = report->events[protocol];
+
+		TC_PRINT("Protocol %d: %d events estimated, %d received\n", protocol, estimated,
+			 received);
+		zassert_true(received > 0, "Protocol %d never received", protocol);
+		zassert_within(estimated, received, EVENT_TOLERANCE(received), "Protocol %d",
+			       protocol);
+	}
+}
+
+static void *schedule_setup(void)
+{
+	uint observer = OBSERVER_DEVICE;
+	uint channel = OBSERVER_CHANNEL;
+
+	observer_channel = bs_open_back_channel(get_device_nbr(), &observer, &channel, 1);
+	zassert_not_null(observer_channel, "No back channel to the observer");
+
+	reset_keys();
+	zassert_ok(tag_main());
+	zassert_true(wait_for_state(TAG_STATE_PROVISIONING, K_SECONDS(5)), "Not provisioning");
+
+	k_msgq_purge(&adv_events);
+	scan_frame(0xf1, NULL, test_apple_key, 20);
+	scan_frame(0xf2, NULL, &test_apple_key[20], 8);
+	provisioned_at_us = k_ticks_to_us_floor64(k_uptime_ticks());
+	scan_frame(0xf3, NULL, test_google_key, GOOGLE_KEY_SIZE);
+
+	zassert_true(next_switch(&first_beacon, K_SECONDS(1)), "No beacon after provisioning");
+	return NULL;
+}
+
+static void schedule_after(void *fixture)
+{
+	if (adv_profile != ADV_PROFILE_FAST) {
+		set_adv_profile(ADV_PROFILE_FAST);
+		k_sleep(K_MSEC(100));
+	}
+}
+
+ZTEST(tag_schedule, test_provisioning_to_first_beacon)
+{
+	const int64_t latency_us = first_beacon.at_us - provisioned_at_us;
+
+	TC_PRINT("Provisioning to first beacon: %lld us\n", (long long)latency_us);
+	zassert_equal(tag_state, TAG_STATE_BEACONING);
+	zassert_equal(first_beacon.protocol, PROTOCOL_APPLE_FINDMY);
+	zassert_true(latency_us >= 0 && latency_us <= FIRST_BEACON_MAX_US,
+		     "First beacon after %lld us", (long long)latency_us);
+}
+
+#if defined(CONFIG_TAG_EXT_ADV)
+ZTEST(tag_schedule, test_events_per_protocol)
+{
+	struct observer_report report;
+	uint32_t before[TAG_STAT_COUNT];
+	uint32_t after[TAG_STAT_COUNT];
+
+	/* Both sets run all the time, a fixed window covers them together */
+	zassert_true(observer_read(&report), "Observer not answering");
+	stats_snapshot(before);
+	k_sleep(EVENT_WINDOW);
+	stats_snapshot(after);
+	zassert_true(observer_read(&report), "Observer not answering");
+
+	assert_events(before, after, &report);
+	zassert_equal(after[TAG_STAT_PROTOCOL_SWITCHES], before[TAG_STAT_PROTOCOL_SWITCHES]);
+	zassert_equal(after[TAG_STAT_ADV_ERRORS], before[TAG_STAT_ADV_ERRORS]);
+}
+
+ZTEST(tag_schedule, test_profile_applied)
+{
+	const struct adv_profile *profile = &adv_profiles[ADV_PROFILE_BALANCED];
+	const struct adv_timing *timing[] = {
+		[PROTOCOL_APPLE_FINDMY] = &profile->apple,
+		[PROTOCOL_GOOGLE_FMDN] = &profile->google,
+	};
+	bool updated[ARRAY_SIZE(timing)] = { false };
+	struct observer_report report;
+	struct adv_event event;
+	uint32_t before[TAG_STAT_COUNT];
+	uint32_t after[TAG_STAT_COUNT];
+
+	/* apply_adv_profile() hands each set its new interval */
+	k_msgq_purge(&adv_events);
+	set_adv_profile(ADV_PROFILE_BALANCED);
+	while (!(updated[PROTOCOL_APPLE_FINDMY] && updated[PROTOCOL_GOOGLE_FMDN])) {
+		zassert_ok(k_msgq_get(&adv_events, &event, SWITCH_TIMEOUT), "Interval not updated");
+		if (event.call == ADV_CALL_PARAM && event.protocol >= 0) {
+			zassert_equal(event.interval_min, timing[event.protocol]->min);
+			updated[event.protocol] = true;
+		}
+	}
+	k_sleep(K_MSEC(100));
+
+	/* And the controller runs it */
+	zassert_true(observer_read(&report), "Observer not answering");
+	stats_snapshot(before);
+	k_sleep(EVENT_WINDOW);
+	stats_snapshot(after);
+	zassert_true(observer_read(&report), "Observer not answering");
+
+	assert_events(before, after, &report);
+	for (int protocol = 0; protocol < ARRAY_SIZE(timing); protocol++) {
+		const uint32_t spacing_us = report.span_us[protocol] / (report.events[protocol] - 1);
+
+		TC_PRINT("Protocol %d: %u us between events\n", protocol, spacing_us);
+		zassert_within(spacing_us, timing[protocol]->min * 625 + 5000, SLOT_JITTER_US,
+			       "Protocol %d", protocol);
+	}
+	zassert_equal(after[TAG_STAT_ADV_ERRORS], before[TAG_STAT_ADV_ERRORS]);
+}
+#else
+ZTEST(tag_schedule, test_switch_gap)
+{
+	const struct adv_profile *profile = &adv_profiles[ADV_PROFILE_FAST];
+	const uint32_t gap_max_us =
+		SWITCH_AIR_GAP_MAX_US(MAX(profile->apple.min, profile->google.min));
+	struct observer_report report;
+	struct adv_switch prev;
+	struct adv_switch sw;
+
+	/* The fast profile runs both protocols at one interval, switches swap in place */
+	k_msgq_purge(&adv_events);
+	zassert_true(next_switch(&prev, SWITCH_TIMEOUT));
+	k_sleep(K_USEC(gap_max_us));
+	zassert_true(observer_read(&report), "Observer not answering");
+
+	for (int i = 0; i < 4; i++) {
+		const int64_t slot_us = protocol_slot_sec[prev.protocol] * USEC_PER_SEC;
+
+		zassert_true(next_switch(&sw, SWITCH_TIMEOUT), "Switch %d missing", i);
+		TC_PRINT("Switch %d: slot %lld us, gap %lld us\n", i,
+			 (long long)(sw.at_us - prev.at_us), (long long)sw.gap_us);
+		zassert_not_equal(sw.protocol, prev.protocol);
+		zassert_false(sw.restarted, "Switch %d restarted the advertiser", i);
+		zassert_within(sw.at_us - prev.at_us, slot_us, SLOT_JITTER_US, "Switch %d", i);
+		prev = sw;
+	}
+	k_sleep(K_USEC(gap_max_us));
+
+	zassert_true(observer_read(&report), "Observer not answering");
+	TC_PRINT("%u switches on air, longest gap %u us\n", report.switches,
+		 report.max_switch_gap_us);
+	zassert_equal(report.switches, 4);
+	zassert_true(report.max_switch_gap_us <= gap_max_us);
+}
+
+ZTEST(tag_schedule, test_switch_gap_restart)
+{
+	const struct adv_profile *profile = &adv_profiles[ADV_PROFILE_BALANCED];
+	const uint32_t gap_max_us =
+		SWITCH_AIR_GAP_MAX_US(MAX(profile->apple.min, profile->google.min));
+	struct observer_report report;
+	struct adv_switch sw;
+
+	/* Balanced runs the protocols at different intervals, each switch restarts */
+	set_adv_profile(ADV_PROFILE_BALANCED);
+	k_sleep(K_MSEC(100));
+	k_msgq_purge(&adv_events);
+	zassert_true(next_switch(&sw, SWITCH_TIMEOUT));
+	k_sleep(K_USEC(gap_max_us));
+	zassert_true(observer_read(&report), "Observer not answering");
+
+	for (int i = 0; i < 2; i++) {
+		zassert_true(next_switch(&sw, SWITCH_TIMEOUT), "Switch %d missing", i);
+		TC_PRINT("Switch %d: gap %lld us\n", i, (long long)sw.gap_us);
+		zassert_true(sw.restarted, "Switch %d", i);
+		zassert_true(sw.gap_us <= RESTART_GAP_MAX_US, "Switch %d off air %lld us", i,
+			     (long long)sw.gap_us);
+	}
+	k_sleep(K_USEC(gap_max_us));
+
+	/* The restart adds to the gap the outgoing interval leaves anyway, no more */
+	zassert_true(observer_read(&report), "Observer not answering");
+	TC_PRINT("%u switches on air, longest gap %u us\n", report.switches,
+		 report.max_switch_gap_us);
+	zassert_equal(report.switches, 2);
+	zassert_true(report.max_switch_gap_us <= gap_max_us);
+}
+
+ZTEST(tag_schedule, test_events_per_protocol)
+{
+	struct observer_report report;
+	uint32_t before[TAG_STAT_COUNT];
+	uint32_t after[TAG_STAT_COUNT];
+	struct adv_switch sw;
+
+	/* Whole cycles, from the start of one Apple slot to another */
+	k_msgq_purge(&adv_events);
+	do {
+		zassert_true(next_switch(&sw, SWITCH_TIMEOUT));
+	} while (sw.protocol != PROTOCOL_APPLE_FINDMY);
+	zassert_true(observer_read(&report), "Observer not answering");
+	stats_snapshot(before);
+
+	for (int i = 0; i < 2 * EVENT_CYCLES; i++) {
+		zassert_true(next_switch(&sw, SWITCH_TIMEOUT), "Switch %d missing", i);
+	}
+	zassert_equal(sw.protocol, PROTOCOL_APPLE_FINDMY);
+	stats_snapshot(after);
+	zassert_true(observer_read(&report), "Observer not answering");
+
+	assert_events(before, after, &report);
+	zassert_equal(after[TAG_STAT_PROTOCOL_SWITCHES] - before[TAG_STAT_PROTOCOL_SWITCHES],
+		      2 * EVENT_CYCLES);
+	zassert_equal(after[TAG_STAT_ADV_ERRORS], before[TAG_STAT_ADV_ERRORS]);
+}
+#endif /* CONFIG_TAG_EXT_ADV */
+
+#if defined(CONFIG_TAG_KEY_UPLOAD) && defined(CONFIG_TAG_EXT_ADV)
+/* Key uploads report to main.c on tag_work_q, the test does the same */
+static void (*tag_work_call_fn)(void);
+K_SEM_DEFINE(tag_work_call_done, 0, 1);
+
+static void tag_work_call_handler(struct k_work *work)
+{
+	tag_work_call_fn();
+	k_sem_give(&tag_work_call_done);
+}
+
+K_WORK_DEFINE(tag_work_call, tag_work_call_handler);
+
+static void call_on_tag_work_q(void (*fn)(void))
+{
+	tag_work_call_fn = fn;
+	k_work_submit_to_queue(&tag_work_q, &tag_work_call);
+	zassert_ok(k_sem_take(&tag_work_call_done, K_SECONDS(1)));
+}
+
+/* The Apple set went back on air, with whatever key is active now */
+static bool apple_restarted(k_timeout_t timeout)
+{
+	struct adv_event event;
+
+	while (k_msgq_get(&adv_events, &event, timeout) == 0) {
+		if (event.call == ADV_CALL_START && event.protocol == PROTOCOL_APPLE_FINDMY) {
+			return true;
+		}
+	}
+	return false;
+}
+
+ZTEST(tag_schedule, test_key_table_upload)
+{
+	zassert_equal(tag_state, TAG_STATE_BEACONING);
+	zassert_equal(key_table_count(), 0);
+	zassert_equal_ptr(apple_key_active, beacon_keys.apple);
+
+	/* A committed upload goes on air at once and starts rotating */
+	k_msgq_purge(&adv_events);
+	call_on_tag_work_q(key_table_fake_upload_commit);
+	zassert_true(apple_restarted(K_SECONDS(1)), "New table not applied");
+	zassert_equal(key_table_count(), KEY_TABLE_FAKE_COUNT);
+	zassert_equal(key_index, 0);
+	zassert_equal_ptr(apple_key_active, key_table_get(0));
+	zassert_true(k_work_delayable_is_pending(&key_rotation_work));
+
+	/* Uploading again while beaconing: the erased table is out of use first */
+	k_msgq_purge(&adv_events);
+	call_on_tag_work_q(key_table_fake_upload_start);
+	zassert_true(apple_restarted(K_SECONDS(1)), "Provisioned key not restored");
+	zassert_equal(key_table_count(), 0);
+	zassert_equal_ptr(apple_key_active, beacon_keys.apple);
+	zassert_false(k_work_delayable_is_pending(&key_rotation_work));
+
+	/* A rotation that still fires finds no table and stops */
+	k_work_reschedule_for_queue(&tag_work_q, &key_rotation_work, K_NO_WAIT);
+	k_sleep(K_MSEC(100));
+	zassert_false(k_work_delayable_is_pending(&key_rotation_work));
+	zassert_equal_ptr(apple_key_active, beacon_keys.apple);
+	zassert_equal(tag_state, TAG_STATE_BEACONING);
+
+	/* Committing that upload brings the table back, from its first slot */
+	call_on_tag_work_q(key_table_fake_upload_commit);
+	zassert_equal_ptr(apple_key_active, key_table_get(0));
+	zassert_true(k_work_delayable_is_pending(&key_rotation_work));
+
+	/* Leave no table behind for the other tests */
+	call_on_tag_work_q(key_table_fake_upload_start);
+	zassert_false(k_work_delayable_is_pending(&key_rotation_work));
+}
+#endif
+
+ZTEST_SUITE(tag_schedule, NULL, schedule_setup, NULL, schedule_after, NULL);
+#endif /* CONFIG_BOARD_NRF52_BSIM */